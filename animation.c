@@ -0,0 +1,239 @@
+#include "hal.h"
+#include <stdint.h>
+
+#include "animation.h"
+#include "led_control.h"
+#include "timing_funcs.h"
+
+// Board size
+#define NUM_LEDS 128
+#define COLUMNS 8
+#define ROWS 16
+
+// RNG
+unsigned int rand32(int seed);
+
+/* Interpreter state of the playing script. */
+static const uint8_t *script_start;
+static const uint8_t *pc;           // Code to run next.
+static const uint8_t *loop_pc;      // Code after the ANIM_REPEAT.
+static uint8_t loop_count;          // Repeats left.
+static uint8_t anim_color;          // ANIM_COLOR.
+static uint8_t step;                // Step of the running multi-step code.
+static uint8_t wait_ticks;          // Ticks left before the next code.
+
+static volatile uint8_t *cancel_state; // Buttons that cancel play_animation().
+static uint8_t cancelled;
+
+/* Returns the color operand at "operand", resolving ANIM_COLOR. */
+static uint8_t
+color_at(const uint8_t *operand)
+{
+    return *operand == ANIM_COLOR ? anim_color : *operand;
+}
+
+/* Sets the LEDs of "row" in the "columns" bit mask to "color". */
+static void
+draw_row(unsigned int row, uint8_t columns, uint8_t color)
+{
+    unsigned int column;
+    
+    for (column = 0; column < COLUMNS; column++) {
+        if (columns & (1 << column)) {
+            set_color(row * COLUMNS + column, color, back_board());
+        }
+    }
+}
+
+/* Sets every LED to "color" without refreshing the board, unlike
+ * fill_strip().
+ */
+static void
+fill_board(uint8_t color)
+{
+    unsigned int row;
+    
+    for (row = 0; row < ROWS; row++) {
+        draw_row(row, ANIM_ALL_COLUMNS, color);
+    }
+}
+
+/* Runs one step of the multi-step code at pc. Returns 1 after its last
+ * step.
+ */
+static unsigned int
+run_step()
+{
+    uint8_t color = color_at(pc + 1);
+    unsigned int led;
+    unsigned int row;
+    unsigned int probes;
+    
+    switch (*pc) {
+    case ANIM_ROWS:
+        draw_row(step, pc[2], color);
+        return step == ROWS - 1;
+    case ANIM_ROWS_IN:
+        draw_row(step, pc[2], color);
+        draw_row(ROWS - 1 - step, pc[2], color);
+        return step == ROWS / 2 - 1;
+    case ANIM_SNAKE:
+        // Odd rows run backward.
+        row = step / COLUMNS;
+        led = step % COLUMNS;
+        if (row & 1) led = COLUMNS - 1 - led;
+        set_color(row * COLUMNS + led, color, back_board());
+        return step == NUM_LEDS - 1;
+    case ANIM_SPARKLE:
+    default:
+        // Probe from a random LED to the next unlit one. Ends early once
+        // every LED is lit.
+        led = ((rand32(0) << 2) ^ rand32(0)) % NUM_LEDS;
+        for (probes = 0; probes < NUM_LEDS; probes++) {
+            if (!get_color(led, back_board())) break;
+            led = (led + 1) % NUM_LEDS;
+        }
+        if (probes == NUM_LEDS) return 1;
+        set_color(led, color, back_board());
+        return step == NUM_LEDS - 1;
+    }
+}
+
+/* Starts "script", with "color" for ANIM_COLOR. */
+void
+animation_start(const uint8_t *script, uint8_t color)
+{
+    script_start = script;
+    pc = script;
+    loop_count = 0;
+    anim_color = color;
+    step = 0;
+    wait_ticks = 0;
+}
+
+/* Advances the script by one tick: runs codes until one of them waits.
+ * Returns 0 once the script has ended.
+ */
+unsigned int
+animation_step()
+{
+    unsigned int led;
+    unsigned int length;
+    
+    if (wait_ticks && --wait_ticks) return 1;
+    
+    while (1) {
+        switch (*pc) {
+        case ANIM_END:
+            return 0;
+        case ANIM_CLEAR:
+            fill_board(OFF);
+            pc += 1;
+            break;
+        case ANIM_FILL:
+            fill_board(color_at(pc + 1));
+            pc += 2;
+            break;
+        case ANIM_SHOW:
+            refresh_board(back_board());
+            pc += 1;
+            break;
+        case ANIM_DELAY:
+            wait_ticks = pc[1];
+            pc += 2;
+            if (wait_ticks) return 1;
+            break;
+        case ANIM_RECOLOR:
+            for (led = 0; led < NUM_LEDS; led++) {
+                if (get_color(led, back_board()) == color_at(pc + 1)) {
+                    set_color(led, color_at(pc + 2), back_board());
+                }
+            }
+            pc += 3;
+            break;
+        case ANIM_FADES:
+            // Every frame moves the fades on.
+            refresh_board(back_board());
+            if (fades_active()) {
+                wait_ticks = pc[1];
+                return 1;
+            }
+            pc += 2;
+            break;
+        case ANIM_ROWS:
+        case ANIM_ROWS_IN:
+        case ANIM_SNAKE:
+        case ANIM_SPARKLE:
+            // The delay is the last operand.
+            length = (*pc == ANIM_ROWS || *pc == ANIM_ROWS_IN) ? 4 : 3;
+            wait_ticks = pc[length - 1];
+            if (run_step()) {
+                pc += length;
+                step = 0;
+            } else {
+                step++;
+            }
+            refresh_board(back_board());
+            if (wait_ticks) return 1;
+            break;
+        case ANIM_REPEAT:
+            loop_count = pc[1];
+            pc += 2;
+            loop_pc = pc;
+            break;
+        case ANIM_LOOP:
+        default:
+            pc += 1;
+            if (loop_count) {
+                loop_count--;
+                pc = loop_pc;
+            }
+            break;
+        }
+    }
+}
+
+/* Task of play_animation(): one step per tick, ends on a press when
+ * cancellable.
+ */
+static void
+animation_task()
+{
+    if (cancel_state && *cancel_state) {
+        cancelled = 1;
+        stop_tasks();
+    } else if (!animation_step()) {
+        stop_tasks();
+    }
+}
+
+/* Plays "script" to its end as a task of run_tasks(), with "color" for
+ * ANIM_COLOR. Input tasks keep running in between. Should MAX_TASKS
+ * tasks be added already, the script is played with blocking waits. When allow_interrupt
+ * is > 0, the animation is cancelled as soon as the value pointed to by
+ * "button_state" shows a press.
+ *
+ * Returns 1 if cancelled.
+ */
+unsigned int
+play_animation(const uint8_t *script, uint8_t color,
+               volatile uint8_t *button_state, int allow_interrupt)
+{
+    animation_start(script, color);
+    cancel_state = allow_interrupt ? button_state : 0;
+    cancelled = 0;
+    if (cancel_state && *cancel_state) return 1;
+    
+    // The first step is drawn right away, the others on ticks.
+    if (!animation_step()) return 0;
+    if (task_add(animation_task, ANIM_TICK_MS, allow_interrupt)) {
+        run_tasks(button_state);
+        return cancelled;
+    }
+    
+    // No task left to play it with, so block on the ticks instead.
+    while (!wait(ANIM_TICK_MS, button_state, allow_interrupt)) {
+        if (!animation_step()) return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,76 @@
+/*************************************************************************
+ * Plays LED animations described by scripts of byte codes in flash.
+ *
+ * void animation_start(const uint8_t *script, uint8_t color);
+ *      Starts the script. ANIM_COLOR in it stands for "color".
+ *
+ * unsigned int animation_step();
+ *      Advances the started script by one tick of ANIM_TICK_MS, drawing
+ *      into back_board() and refreshing the board as it says. Returns 0
+ *      once the script has ended. Never blocks.
+ *
+ * unsigned int play_animation(const uint8_t *script, uint8_t color,
+ *                             volatile uint8_t *button_state, int allow_interrupt);
+ *      Plays the script as a task of run_tasks(). When allow_interrupt is
+ *      > 0, a press cancels it. Returns 1 if cancelled.
+ *
+ ************************************************************************/
+
+#ifndef animation_h
+#define animation_h
+
+#include <stdio.h>
+
+#define ANIM_TICK_MS    10      // Time of one step of animation_step().
+
+/* Byte codes, each followed by its operands. Operations that are not
+ * shown only draw into back_board(). Delays count ANIM_TICK_MS ticks.
+ *  ANIM_END                          - end of the script.
+ *  ANIM_CLEAR                        - all LEDs off, not shown.
+ *  ANIM_FILL color                   - all LEDs to color, not shown.
+ *  ANIM_SHOW                         - refresh the board.
+ *  ANIM_DELAY ticks                  - wait.
+ *  ANIM_RECOLOR from to              - LEDs of color "from" to color "to",
+ *                                      not shown.
+ *  ANIM_FADES ticks                  - show every "ticks" ticks until the
+ *                                      fades of fade_color() have ended,
+ *                                      which move on once per show.
+ *  ANIM_ROWS color columns ticks     - for each row from the bottom, set
+ *                                      the columns in the bit mask to
+ *                                      color, show and wait.
+ *  ANIM_ROWS_IN color columns ticks  - the same for the top and bottom
+ *                                      rows at once, toward the middle.
+ *  ANIM_SNAKE color ticks            - serpentine walk over every LED,
+ *                                      showing and waiting for each.
+ *  ANIM_SPARKLE color ticks          - light a random unlit LED, show and
+ *                                      wait, until all LEDs are lit. Does
+ *                                      nothing on a full board.
+ *  ANIM_REPEAT count                 - repeat up to ANIM_LOOP "count" more
+ *                                      times. Loops do not nest.
+ *  ANIM_LOOP                         - end of the repeated codes.
+ */
+#define ANIM_END        0
+#define ANIM_CLEAR      1
+#define ANIM_FILL       2
+#define ANIM_SHOW       3
+#define ANIM_DELAY      4
+#define ANIM_RECOLOR    5
+#define ANIM_ROWS       6
+#define ANIM_ROWS_IN    7
+#define ANIM_SNAKE      8
+#define ANIM_SPARKLE    9
+#define ANIM_REPEAT     10
+#define ANIM_LOOP       11
+#define ANIM_FADES      12
+
+#define ANIM_COLOR      0xFF    // The color given to animation_start().
+
+#define ANIM_EVEN_COLUMNS   0x55
+#define ANIM_ODD_COLUMNS    0xAA
+#define ANIM_ALL_COLUMNS    0xFF
+
+void animation_start(const uint8_t *script, uint8_t color);
+unsigned int animation_step();
+unsigned int play_animation(const uint8_t *script, uint8_t color,
+                            volatile uint8_t *button_state, int allow_interrupt);
+#endif /* animation_h */
@@ -10,45 +10,37 @@
  * button_state: the pressed state of the each capacitive button.
  *
  ********************************************************************/
-#include <msp430.h>
+#include "hal.h"
 #include <stdint.h>
+#include <string.h>
 
+#include "animation.h"
 #include "cap_sense.h"
 #include "cap_setup.h"
 #include "led_control.h"
 #include "timing_funcs.h"
 
+// The two tasks of a game and the one of a nested play_animation().
+#if MAX_TASKS < 3
+#error MAX_TASKS is too small for the game tasks and an animation!
+#endif
+
 // Board size
 #define NUM_LEDS 128
 #define COLUMNS 8
 #define ROWS 16
 
 
-// LED colors
-#define OFF           0
-#define RED           1
-#define GREEN         2
-#define BLUE          3
-#define RED_FADE_1    4
-#define RED_FADE_2    5
-#define RED_FADE_3    6
-#define BLUE_FADE_1   7
-#define BLUE_FADE_2   8
-#define BLUE_FADE_3   9
-#define GREEN_FADE_1  10
-#define GREEN_FADE_2  11
-#define GREEN_FADE_3  12
-#define YELLOW        13
-#define PURPLE        14
-
-#define BRIGHTNESS    3
-
 // Global states
 #define CHOOSE_GAME 0
 #define STACKER 1
 #define DODGE_GAME 2
 #define SELF          YELLOW
 
+// Frames of the fade of lost stacker blocks, shown every 20ms by
+// block_loss_script: 1.5s.
+#define BLOCK_FADE_FRAMES 75
+
 // Game states
 #define START 0
 #define PLAY 1
@@ -57,13 +49,6 @@
 
 
 
-// WS2812 LEDs require GRB format
-typedef struct {
-    unsigned char green;
-    unsigned char red;
-    unsigned char blue;
-} LED;
-
 /* Function Prototypes */
 void leds_from_press();
 
@@ -79,6 +64,8 @@ void waitForRelease(void);
 
 // Stacker Functions
 void stacker_fsm();
+void stacker_slide_task();
+void stacker_press_task();
 void slide_block(uint8_t row, uint8_t num_blocks);
 void animate_block_loss(unsigned int *lost_blocks, unsigned int num_lost_blocks);
 void shift_left(uint8_t row, uint8_t num_blocks);
@@ -88,18 +75,19 @@ void shift_right(uint8_t row, uint8_t num_blocks);
 void move_character(uint8_t direction);
 uint8_t buttons_to_direction();
 void dodge_game_fsm();
+void dodge_fall_task();
+void dodge_move_task();
 void update_falling_blocks();
+void draw_dodge();
 
 /* Global Parameters */
 
-// Represent every LED with one byte.
-static uint8_t led_board[NUM_LEDS];
+// Frames are drawn into back_board() and sent by refresh_board(back_board()).
 unsigned int maxLights[ROWS] = {4, 4, 4, 4, 3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1};
-unsigned char startFilled[NUM_LEDS];
 
 // Capacitive Sensing
 /* Pressed Buttons: 0 - Up   1 - Right   2 - Down    3 - Left    4 - Middle */
-uint8_t button_state = 0x00;
+volatile uint8_t button_state = 0x00;
 
 // Random number generation
 unsigned int rng_seed;
@@ -123,17 +111,20 @@ static unsigned int prev_width = 4;
 // Dodge game parameters
 static uint8_t position = 67;
 static unsigned int fall_time = 500;        //0.5s
-static unsigned int fall_time_count = 0;
+
+/* Falling blocks of the dodge game, a bit per column in every row from
+ * the bottom up. The board is only generated from it while a frame is
+ * streamed by draw_dodge().
+ */
+static uint8_t world[ROWS];
+
+// Row and column bit of the character.
+#define POSITION_ROW   (position / COLUMNS)
+#define POSITION_BIT   (1 << (position % COLUMNS))
 
 int
 main(void)
 {
-    // Initialize the led_board.
-    int i;
-    for (i = 0; i < NUM_LEDS; i++) {
-        led_board[i] = 0x00;
-    }
-    
     /* Generate a unique random seed based on VLO - DCO differences */
     rng_seed = generate_seed();
     
@@ -144,8 +135,8 @@ main(void)
     random_num = rand32(1);
     
     // Turn off the LED grid.
-    clear_strip(led_board);
-    refresh_board(led_board);
+    clear_strip(back_board());
+    refresh_board(back_board());
     
     
     dir = 1;
@@ -176,12 +167,11 @@ main(void)
                 
                 // Detect release and transition.
                 if (pressed) {
-                    if (!button_state) {
-                        pressed = 0;
-                        clear_strip(led_board);
-                        global_state = next_game;
-                        current_state = START;
-                    }
+                    waitForRelease();
+                    pressed = 0;
+                    clear_strip(back_board());
+                    global_state = next_game;
+                    current_state = START;
                 }
                 break;
             case STACKER:
@@ -201,109 +191,34 @@ main(void)
 void
 stacker_fsm()
 {
-    static int pressed = 0;
-    
-    unsigned int block;
-    unsigned int next_width;
-    unsigned int found_left;
-    unsigned int next_leftmost;
-    unsigned int lost_blocks[COLUMNS];
-    unsigned int num_lost_blocks = 0;
-    unsigned int change_leftmost = 0;
-    
     switch(current_state) {
         case START:
             
             // Initialize Stacker parameters
-            pressed = 0;
             current_row = 0;
             current_width = start_width;
             prev_width = start_width;
             prev_leftmost = 0;
-            found_left = 0;
             GAME_COLOR = BLUE;
+            touch_flush();
             current_state = PLAY;
             break;
         case PLAY:
-            // Move block back and forth.
-            slide_block(current_row, current_width);
-            refresh_board(led_board);
-            if (wait(100, &button_state, 0)) return;
-            
-            
-            if (button_state) {
-                current_row++;
-                
-                // The first row can be stopped anywhere.
-                if (current_row == 1) {
-                    prev_width = current_width;
-                    prev_leftmost = leftmost_block;
-                    waitForRelease();
-                    return;
-                }
-                
-                found_left = 0;
-                change_leftmost = 0;
-                next_width = current_width;
-                next_leftmost = leftmost_block;
-                
-                // Check the alignment of each block with the previous row.
-                for (block = leftmost_block; block < leftmost_block + current_width; block++) {
-                    // Off to the left or off to the right
-                    if (block < prev_leftmost || block > prev_leftmost + prev_width - 1) {
-                        
-                        // If the leftmost block is off, next_leftmost needs to be determined.
-                        if (block == leftmost_block) {
-                            change_leftmost = 1;
-                        }
-                        
-                        // Increment to determine the new next_leftmost block.
-                        if (change_leftmost && !found_left) {
-                            next_leftmost++;
-                        }
-                        // Decrement the width of the next row
-                        next_width--;
-                        
-                        lost_blocks[num_lost_blocks] = (current_row - 1) * COLUMNS + block;
-                        num_lost_blocks++;
-                        //animate_block_loss(current_row - 1, block);
-                    } else {
-                        found_left = 1;
-                    }
-                }
-                
-                animate_block_loss(lost_blocks, num_lost_blocks);
-                
-                // Save the current leftmost and width to check next row's alignment.
-                prev_leftmost = next_leftmost;
-                prev_width = next_width;
-                current_width = maxLights[current_row];
-                
-                waitForRelease();
-            }
-            
-            // Check if all blocks were lost and transition.
-            if (!prev_width) {
-                current_state = LOSE;
-                return;
-            }
-            
-            // Detect win and transition.
-            if (current_row >= ROWS) {
-                current_state = WIN;
-                return;
-            }
-            
+            // The block slides every .1s and stops on every press, until
+            // the game is won or lost.
+            task_add(stacker_slide_task, 100, 0);
+            task_add(stacker_press_task, 100, 1);
+            run_tasks(&button_state);
             break;
         case WIN:
-            clear_strip(led_board);
+            clear_strip(back_board());
             animate_win();
             
             // Return to the outer fsm.
             global_state = CHOOSE_GAME;
             break;
         case LOSE:
-            clear_strip(led_board);
+            clear_strip(back_board());
             animate_lose();
             
             // Return to the outer fsm.
@@ -312,59 +227,115 @@ stacker_fsm()
     }
 }
 
+/* Stacker task: moves the block back and forth. */
+void
+stacker_slide_task()
+{
+    slide_block(current_row, current_width);
+    refresh_board(back_board());
+}
+
+/* Stacker task: stops the block on a press and trims it to the row below.
+ * Also runs every .1s, so presses queued during the block loss animation
+ * are not lost.
+ */
+void
+stacker_press_task()
+{
+    unsigned int block;
+    unsigned int next_width;
+    unsigned int found_left;
+    unsigned int next_leftmost;
+    unsigned int lost_blocks[COLUMNS];
+    unsigned int num_lost_blocks = 0;
+    unsigned int change_leftmost = 0;
+    
+    if (!touch_press()) return;
+    current_row++;
+    
+    // The first row can be stopped anywhere.
+    if (current_row == 1) {
+        prev_width = current_width;
+        prev_leftmost = leftmost_block;
+        return;
+    }
+    
+    found_left = 0;
+    next_width = current_width;
+    next_leftmost = leftmost_block;
+    
+    // Check the alignment of each block with the previous row.
+    for (block = leftmost_block; block < leftmost_block + current_width; block++) {
+        // Off to the left or off to the right
+        if (block < prev_leftmost || block > prev_leftmost + prev_width - 1) {
+            
+            // If the leftmost block is off, next_leftmost needs to be determined.
+            if (block == leftmost_block) {
+                change_leftmost = 1;
+            }
+            
+            // Increment to determine the new next_leftmost block.
+            if (change_leftmost && !found_left) {
+                next_leftmost++;
+            }
+            // Decrement the width of the next row
+            next_width--;
+            
+            lost_blocks[num_lost_blocks] = (current_row - 1) * COLUMNS + block;
+            num_lost_blocks++;
+        } else {
+            found_left = 1;
+        }
+    }
+    
+    // Runs its own tasks while these wait.
+    animate_block_loss(lost_blocks, num_lost_blocks);
+    
+    // Save the current leftmost and width to check next row's alignment.
+    prev_leftmost = next_leftmost;
+    prev_width = next_width;
+    
+    // Check if all blocks were lost and transition.
+    if (!prev_width) {
+        current_state = LOSE;
+        stop_tasks();
+        return;
+    }
+    
+    // Detect win and transition.
+    if (current_row >= ROWS) {
+        current_state = WIN;
+        stop_tasks();
+        return;
+    }
+    current_width = maxLights[current_row];
+}
+
 /* Play the dodge game! */
 void
 dodge_game_fsm()
 {
-    int rng_col;
-    int rng_count;
     switch (current_state) {
         case START:
-            // Start the player in the middle of the board.
+            // Start the player in the middle of an empty board.
             position = 67;
-            fall_time_count = 0;
-            clear_strip(led_board);
-            set_color(position, SELF, led_board);
-            refresh_board(led_board);
+            memset(world, 0, sizeof(world));
             GAME_COLOR = PURPLE;
+            draw_dodge();
+            touch_flush();
             current_state = PLAY;
             break;
         case PLAY:
-            
-            // Move blocks down half second.
-            if (fall_time_count > fall_time) {
-                
-                // Move blocks down
-                update_falling_blocks();
-                
-                // Randomly generate at most 4 blocks in the top row.
-                rng_count = 0;
-                for (rng_col; rng_col < COLUMNS; rng_col++) {
-                    if (rng_count > 4) break;
-                    
-                    // Light up the the led in rng_col.
-                    if (rand32(0) < 3) {
-                        led_board[((ROWS-1) * COLUMNS) + rng_col] = RED;
-                        rng_count++;
-                    }
-                }
-            
-                // Transmit the new LED board.
-                refresh_board(led_board);
-                fall_time_count = 0;
-            }
-            
-            // Check for button presses and move character.
-            move_character(buttons_to_direction());
-            
-            // Delay .1s to control movement.
-            wait(100, &button_state, 0);
-            
+            // Blocks fall every fall_time and the character moves on every
+            // press, and every .1s while held, until a collision.
+            task_add(dodge_fall_task, fall_time, 0);
+            task_add(dodge_move_task, 100, 1);
+            run_tasks(&button_state);
             break;
         case LOSE:
             // Freeze board on lose, then transition.
             wait(2000, &button_state, 0);
-            clear_strip(led_board);
+            clear_strip(back_board());
             animate_lose();
             global_state = CHOOSE_GAME;
             break;
@@ -374,63 +345,90 @@ dodge_game_fsm()
 }
 
 
+/* Dodge game task: moves the blocks down and adds new ones at the top. */
+void
+dodge_fall_task()
+{
+    int rng_col;
+    int rng_count;
+    uint8_t spawn = 0;
+    
+    // The world is read while the last frame is streamed.
+    refresh_wait();
+    
+    // Move blocks down
+    update_falling_blocks();
+    
+    // Randomly generate at most 4 blocks in the top row.
+    rng_count = 0;
+    for (rng_col = 0; rng_col < COLUMNS; rng_col++) {
+        if (rng_count > 4) break;
+        
+        // Light up the the led in rng_col.
+        if (rand32(0) < 3) {
+            spawn |= 1 << rng_col;
+            rng_count++;
+        }
+    }
+    world[ROWS - 1] |= spawn;
+    
+    // A block landing on the character.
+    if (world[POSITION_ROW] & POSITION_BIT) current_state = LOSE;
+    
+    // Transmit the new LED board.
+    draw_dodge();
+    if (current_state == LOSE) stop_tasks();
+}
+
+/* Dodge game task: moves the character on presses. */
+void
+dodge_move_task()
+{
+    move_character(buttons_to_direction());
+    if (current_state == LOSE) stop_tasks();
+}
+
 /* Blocks until all buttons are released. */
 void
 waitForRelease(void) {
     while (1) {
         wait(1, &button_state, 0);
-        if (button_state == 0)
+        if (touch_state() == 0)
             return;
     }
 }
 
-/* Parses the pressed button state to determine movement direction. */
+/* Parses the oldest queued press, or else the held buttons, to determine
+ * movement direction. Taps between two calls still move.
+ */
 uint8_t
 buttons_to_direction()
 {
-    if (!button_state) return (0);
+    uint8_t pressed = touch_press();
+    
+    if (!pressed) pressed = touch_state();
+    if (!pressed) return (0);
     
     // Parse button presses with priority.
-    if ((button_state & BIT0) != 0) return (1);
-    else if ((button_state & BIT1) != 0) return (2);
-    else if ((button_state & BIT2) != 0) return (3);
-    else if ((button_state & BIT3) != 0) return (4);
+    if ((pressed & BIT0) != 0) return (1);
+    else if ((pressed & BIT1) != 0) return (2);
+    else if ((pressed & BIT2) != 0) return (3);
+    else if ((pressed & BIT3) != 0) return (4);
     
     
     return 0;
 }
 
-/* Moves all falling blocks down one position and detects blocks moving out of
- * the board.
- */
+/* Moves all falling blocks down one row, dropping the bottom row. */
 void
 update_falling_blocks()
 {
-    int led;
-    
-    // Detect all leds falling out of the board (in first row).
-    for (led = 0; led < COLUMNS; led++) {
-        if (led_board[led]) {
-            if (led == position) continue;
-            led_board[led] = OFF;
-        }
-    }
+    int row;
     
-    for (led = COLUMNS; led < NUM_LEDS; led++) {
-        // If the led is ON, set the LED below it on, and turn it off.
-        if (led_board[led]) {
-            if (led == position) continue;
-            // COLLISION!!!
-            if ((led - COLUMNS) == position) {
-                set_color(position, RED, led_board);
-                current_state = LOSE;
-                continue;
-            }
-            
-            set_color(led, OFF, led_board);
-            set_color(led - COLUMNS, GAME_COLOR, led_board);
-        }
+    for (row = 0; row < ROWS - 1; row++) {
+        world[row] = world[row + 1];
     }
+    world[ROWS - 1] = 0;
 }
 
 /* Moves the character based on direction and detect colisions.
@@ -439,65 +437,63 @@ update_falling_blocks()
 void
 move_character(uint8_t direction)
 {
+    uint8_t next = position;
+    
     switch (direction) {
         case 1:
             // Move up if possible.
-            if (position < 120) {
-                // Turn off current position.
-                set_color(position, OFF, led_board);
-                position += 8;
-            } else {
-                return;
-            }
+            if (position < 120) next += 8;
             break;
         case 2:
             // Move right if possible.
-            if (position % COLUMNS != 0) {
-                // Turn off current position.
-                set_color(position, OFF, led_board);
-                position--;
-            } else {
-                return;
-            }
+            if (position % COLUMNS != 0) next--;
             break;
         case 3:
             // Move down if possible.
-            if (position > 7) {
-                // Turn off current position.
-                set_color(position, OFF, led_board);
-                position -= 8;
-            } else {
-                return;
-            }
+            if (position > 7) next -= 8;
             break;
         case 4:
             // Move left if possible.
-            if (position % COLUMNS != COLUMNS - 1) {
-                // Turn off current position.
-                set_color(position, OFF, led_board);
-                position++;
-            } else {
-                return;
-            }
+            if (position % COLUMNS != COLUMNS - 1) next++;
             break;
         default:
-            return;
             break;
-            
     }
+    if (next == position) return;
+    
+    // The position is read while the last frame is streamed.
+    refresh_wait();
+    position = next;
     
     // COLLISION!!
-    if (led_board[position]) {
-        led_board[position] = RED;
-        refresh_board(led_board);
-        current_state = LOSE;
-        return;
-    }
+    if (world[POSITION_ROW] & POSITION_BIT) current_state = LOSE;
     
     // Update position.
-    set_color(position, SELF, led_board);
-    refresh_board(led_board);
+    draw_dodge();
+}
+
+/* Returns the color of LED led of the dodge game. Called by the transmit
+ * interrupt while draw_dodge() streams a frame.
+ */
+static uint8_t
+dodge_pixel(unsigned int led)
+{
+    unsigned int row = led / COLUMNS;
     
+    if (led == position) return (current_state == LOSE) ? RED : SELF;
+    if (!(world[row] & (1 << (led % COLUMNS)))) return OFF;
+    
+    // Blocks spawn red and fall in the game color.
+    return (row == ROWS - 1) ? RED : GAME_COLOR;
+}
+
+/* Sends the dodge game to the board, generated from the world and the
+ * character while the frame is streamed.
+ */
+void
+draw_dodge()
+{
+    stream_board(dodge_pixel, NUM_LEDS);
 }
 
 
@@ -540,12 +536,12 @@ shift_left(uint8_t row, uint8_t num_blocks)
 {
     // Remove rightmost block
     int old_rightmost = row*COLUMNS + leftmost_block + num_blocks - 1;
-    set_color(old_rightmost, OFF, led_board);
+    set_color(old_rightmost, OFF, back_board());
     
     // update left_most block
     leftmost_block--;
     int new_leftmost = row*COLUMNS + leftmost_block;
-    set_color(new_leftmost, GAME_COLOR, led_board);
+    set_color(new_leftmost, GAME_COLOR, back_board());
 }
 
 
@@ -559,11 +555,11 @@ shift_right(uint8_t row, uint8_t num_blocks)
 {
     // Remove leftmost block
     int old_leftmost = row*COLUMNS + leftmost_block;
-    set_color(old_leftmost, OFF, led_board);
+    set_color(old_leftmost, OFF, back_board());
     
     // Add a new led to the right.
     int new_rightmost = row*COLUMNS + leftmost_block + num_blocks;
-    set_color(new_rightmost, GAME_COLOR, led_board);
+    set_color(new_rightmost, GAME_COLOR, back_board());
     leftmost_block++;
     
 }
@@ -584,234 +580,87 @@ leds_from_press()
     P3OUT |= local_pressed;
 }
 
-/* Clear the color representation array for start animation. */
-void
-clearStart(void)
-{
-    int li;
-    for (li = 0; li < NUM_LEDS; li ++)
-        startFilled[li] = 0;
-}
-
-
 /* Start animation for STACKER
  * Randomly lights up LEDs on the board, then flashes 3 times
  */
+static const uint8_t start_script[] = {
+    ANIM_CLEAR, ANIM_SHOW,
+    ANIM_DELAY, 50,
+    ANIM_SPARKLE, ANIM_COLOR, 10,
+    ANIM_REPEAT, 1,
+        ANIM_FILL, ANIM_COLOR, ANIM_SHOW, ANIM_DELAY, 50,
+        ANIM_CLEAR, ANIM_SHOW, ANIM_DELAY, 50,
+    ANIM_LOOP,
+    ANIM_FILL, ANIM_COLOR, ANIM_SHOW, ANIM_DELAY, 50,
+    ANIM_END
+};
+
 void
 animate_start()
 {
-    clear_strip(led_board);
-    if (wait(500, &button_state, 1)) return;
-    int led;
-    
-    clearStart();
-    
-    int r1;
-    int r2;
-    for (led = 0; led < (NUM_LEDS); led++) {
-        int numWhile = 0;
-        while (1) {
-            numWhile ++;
-            
-            if (numWhile >= 100 && led > 52) {
-                numWhile = 0;
-                break;
-            }
-            
-            r1 = rand32(0) + rand32(0);
-            r2 = rand32(0) + rand32(0);
-            if (startFilled[r1+r2] == 1)
-                continue;
-            else {
-                startFilled[r1+r2] = 1;
-                break;
-            }
-            
-        }
-
-        set_color(r1 + r2, GAME_COLOR, led_board);
-        
-        refresh_board(led_board);
-        if (wait(100, &button_state, 1)) return;
-    }
-    fill_strip(GAME_COLOR, led_board);
-    if (wait(500, &button_state, 1)) return;
-    clear_strip(led_board);
-    if (wait(500, &button_state, 1)) return;
-    fill_strip(GAME_COLOR, led_board);
-    if (wait(500, &button_state, 1)) return;
-    clear_strip(led_board);
-    if (wait(500, &button_state, 1)) return;
-    fill_strip(GAME_COLOR, led_board);
-    if (wait(500, &button_state, 1)) return;
-    
+    play_animation(start_script, GAME_COLOR, &button_state, 1);
 }
 
 
 /* Fade animation for misaligned blocks. */
+static const uint8_t block_loss_script[] = {
+    ANIM_FADES, 2,
+    ANIM_DELAY, 50,
+    ANIM_END
+};
+
 void
 animate_block_loss(unsigned int *lost_blocks, unsigned int num_lost_blocks)
 {
-    
-    int fade_idx;
-    int led;
-    int color = 0x08;
+    unsigned int led;
     
     // If no blocks were lost, just return.
     if (!num_lost_blocks) return;
     
-    // Fade animation.
-    for (led = 0; led < num_lost_blocks; led++) {
-        set_color(lost_blocks[led], BLUE_FADE_1, led_board);
-    }
-    refresh_board(led_board);
-    wait(500, &button_state, 0);
-    
-    for (led = 0; led < num_lost_blocks; led++) {
-        set_color(lost_blocks[led], BLUE_FADE_2, led_board);
-    }
-    refresh_board(led_board);
-    wait(500, &button_state, 0);
-    
-    for (led = 0; led < num_lost_blocks; led++) {
-        set_color(lost_blocks[led], BLUE_FADE_3, led_board);
-    }
-    refresh_board(led_board);
-    wait(500, &button_state, 0);
-    
+    // Fade the lost blocks out. Nothing else refreshes the board while
+    // block_loss_script runs, as the enclosing tasks wait for it.
     for (led = 0; led < num_lost_blocks; led++) {
-        set_color(lost_blocks[led], OFF, led_board);
+        fade_color(lost_blocks[led], get_color(lost_blocks[led], back_board()),
+                   OFF, BLOCK_FADE_FRAMES, back_board());
     }
-    refresh_board(led_board);
-    wait(500, &button_state, 0);
-    
+    play_animation(block_loss_script, GAME_COLOR, &button_state, 0);
 }
 
 /* Win animation. */
+static const uint8_t win_script[] = {
+    ANIM_CLEAR,
+    ANIM_ROWS, GREEN, ANIM_EVEN_COLUMNS, 10,
+    ANIM_ROWS, OFF, ANIM_EVEN_COLUMNS, 10,
+    ANIM_ROWS, GREEN, ANIM_ODD_COLUMNS, 10,
+    ANIM_ROWS, OFF, ANIM_ODD_COLUMNS, 10,
+    
+    // Green from top and bottom
+    ANIM_CLEAR, ANIM_SHOW,
+    ANIM_ROWS_IN, GREEN, ANIM_ALL_COLUMNS, 30,
+    ANIM_DELAY, 30,
+    ANIM_CLEAR, ANIM_SHOW, ANIM_DELAY, 30,
+    ANIM_FILL, GREEN, ANIM_SHOW, ANIM_DELAY, 50,
+    ANIM_CLEAR, ANIM_SHOW, ANIM_DELAY, 30,
+    ANIM_END
+};
+
 void
 animate_win()
 {
-    clear_strip(led_board);
-    
-    int row;
-    int led;
-    int offset;
-    
-    for (row = 0; row < ROWS; row++) {
-        offset = row * COLUMNS;
-        for (led = 0; led < COLUMNS; led+=2) {
-            set_color(offset + led, GREEN, led_board);
-        }
-        refresh_board(led_board);
-        if (wait(100, &button_state, 0)) return;
-    }
-    
-    for (row = 0; row < ROWS; row++) {
-        offset = row * COLUMNS;
-        for (led = 0; led < COLUMNS; led+=2) {
-            set_color(offset + led, OFF, led_board);
-        }
-        refresh_board(led_board);
-        if (wait(100, &button_state, 0)) return;
-    }
-    
-    for (row = 0; row < ROWS; row++) {
-        offset = row * COLUMNS;
-        for (led = 1; led < COLUMNS; led+=2) {
-            set_color(offset + led, GREEN, led_board);
-        }
-        refresh_board(led_board);
-        if (wait(100, &button_state, 0)) return;
-    }
-    
-    for (row = 0; row < ROWS; row++) {
-        offset = row * COLUMNS;
-        for (led = 1; led < COLUMNS; led+=2) {
-            set_color(offset + led, OFF, led_board);
-        }
-        refresh_board(led_board);
-        if (wait(100, &button_state, 0)) return;
-    }
-    
-    // Green from top and bottom
-    clear_strip(led_board);
-    refresh_board(led_board);
-    for (row = 0; row < (ROWS >> 1); row++) {
-        offset = row * COLUMNS;
-        for (led = 0; led < COLUMNS; led++) {
-            set_color(offset + led, GREEN, led_board);
-        }
-        offset = (ROWS - row - 1) * COLUMNS;
-        for (led = 0; led < COLUMNS; led++) {
-            set_color(offset + led, GREEN, led_board);
-        }
-        refresh_board(led_board);
-        if (wait(300, &button_state, 0)) return;
-    }
-    
-    if (wait(300, &button_state, 0)) return;
-    clear_strip(led_board);
-    if (wait(300, &button_state, 0)) return;
-    fill_strip(GREEN, led_board);
-    if (wait(500, &button_state, 0)) return;
-    clear_strip(led_board);
-    if (wait(300, &button_state, 0)) return;
-    refresh_board(led_board);
+    play_animation(win_script, GREEN, &button_state, 0);
 }
 
 /* Lose animation */
+static const uint8_t lose_script[] = {
+    ANIM_SNAKE, RED, 10,
+    ANIM_SNAKE, OFF, 10,
+    ANIM_END
+};
+
 void
 animate_lose(void)
 {
-    int li = 0;
-    while (1) {
-        set_color(li, RED, led_board);
-        refresh_board(led_board);
-        if ((li / ROWS) % 2 == 0) {
-            if ((li % COLUMNS) == COLUMNS - 1) {
-                li += COLUMNS;
-                wait(100, &button_state, 0);
-                continue;
-            }
-            li++;
-        } else {
-            if ((li % COLUMNS) == 0) {
-                li += COLUMNS;
-                wait(100, &button_state, 0);
-                continue;
-            }
-            li --;
-        }
-        if (li >= NUM_LEDS - 1) {
-            break;
-        }
-        wait(100, &button_state, 0);
-    }
-    li = 0;
-    while (1) {
-        set_color(li, OFF, led_board);
-        refresh_board(led_board);
-        if ((li / ROWS) % 2 == 0) {
-            if ((li % COLUMNS) == COLUMNS - 1) {
-                li += COLUMNS;
-                wait(100, &button_state, 0);
-                continue;
-            }
-            li ++;
-        } else {
-            if ((li % COLUMNS) == 0) {
-                li += COLUMNS;
-                wait(100, &button_state, 0);
-                continue;
-            }
-            li --;
-        }
-        if (li >= NUM_LEDS - 1) {
-            break;
-        }
-        wait(100, &button_state, 0);
-    }
-    
+    play_animation(lose_script, RED, &button_state, 0);
 }
 
 /*
@@ -898,8 +747,11 @@ generate_seed(void) {
 
 
 
+#if CAP_SENSE_MODE == CAP_SENSE_POLL
 /* Timer A0 interrupt service for capacitive touch timing */
-#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#if defined(HOST_BUILD)
+HOST_ISR(TIMER0_A0_VECTOR, Timer_A0)
+#elif defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
 #pragma vector=TIMER0_A0_VECTOR
 __interrupt void Timer_A (void)
 #elif defined(__GNUC__)
@@ -920,10 +772,15 @@ void __attribute__ ((interrupt(TIMER0_A0_VECTOR))) Timer_A0 (void)
     leds_from_press();
     
 }
+#endif
 
 
-/* Timer A1 interrupt service routine for general timing. Interrrupts every ms. */
-#if defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+/* Timer A1 CCR0 interrupt service routine for general timing. Matches the
+ * deadline of wait() and wakes it up once the deadline is reached.
+ */
+#if defined(HOST_BUILD)
+HOST_ISR(TIMER1_A0_VECTOR, Timer_A1)
+#elif defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
 #pragma vector=TIMER1_A0_VECTOR
 __interrupt void Timer_A1 (void)
 #elif defined(__GNUC__)
@@ -932,7 +789,85 @@ void __attribute__ ((interrupt(TIMER1_A0_VECTOR))) Timer_A1 (void)
 #error Compiler not supported!
 #endif
 {
-    fall_time_count++;
-    __bic_SR_register_on_exit(LPM0_bits);    // Exit low power mode 0.
+    if (timer_deadline()) __bic_SR_register_on_exit(LPM0_bits);
 }
 
+
+
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+/* Port 2 interrupt service routine. Timestamps capacitive pad edges. */
+#if defined(HOST_BUILD)
+HOST_ISR(PORT2_VECTOR, Port_2)
+#elif defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=PORT2_VECTOR
+__interrupt void Port_2 (void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(PORT2_VECTOR))) Port_2 (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    pad_edge();
+}
+#endif
+
+
+/* USCI A0/B0 TX interrupt service routine. Feeds the LED frame to the SPI
+ * transmit buffer one LED at a time.
+ */
+#if defined(HOST_BUILD)
+HOST_ISR(USCIAB0TX_VECTOR, USCI0TX_ISR)
+#elif defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=USCIAB0TX_VECTOR
+__interrupt void USCI0TX_ISR (void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(USCIAB0TX_VECTOR))) USCI0TX_ISR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    transmit_next_led();
+}
+
+
+/* Timer A1 CCR1/CCR2/overflow interrupt service routine. CCR1 generates
+ * the capacitive touch pulse, or the 1ms PinOsc window, CCR2 ends LED
+ * frames and the overflow extends the time base.
+ */
+#if defined(HOST_BUILD)
+HOST_ISR(TIMER1_A1_VECTOR, Timer_A1_CCR)
+#elif defined(__TI_COMPILER_VERSION__) || defined(__IAR_SYSTEMS_ICC__)
+#pragma vector=TIMER1_A1_VECTOR
+__interrupt void Timer_A1_CCR (void)
+#elif defined(__GNUC__)
+void __attribute__ ((interrupt(TIMER1_A1_VECTOR))) Timer_A1_CCR (void)
+#else
+#error Compiler not supported!
+#endif
+{
+    uint8_t last_state = button_state;
+    
+    switch (TA1IV) {
+    case TA1IV_TACCR1:
+#if CAP_SENSE_MODE == CAP_SENSE_PINOSC
+        // Count the next capacitive button's oscillator.
+        TA1CCR1 += TICK_INTERVAL;
+        check_pulse(&button_state);
+#else
+        pulse_edge(&button_state);
+#endif
+        leds_from_press();
+        
+        // Wake wait() up early on a press.
+        if (button_state != last_state) __bic_SR_register_on_exit(LPM0_bits);
+        break;
+    case TA1IV_TACCR2:
+        // Only wake the CPU for refresh_wait().
+        if (end_frame()) __bic_SR_register_on_exit(LPM0_bits);
+        break;
+    case TA1IV_TAIFG:
+        // Arms the deadline of wait() in its last period.
+        if (timer_overflow()) __bic_SR_register_on_exit(LPM0_bits);
+        break;
+    }
+}
@@ -1,19 +1,416 @@
-#include <msp430.h>
+#include "hal.h"
 #include <stdint.h>
 
 #include "cap_sense.h"
+#include "cap_setup.h"
+#include "gesture.h"
+#include "led_control.h"
+#include "timing_funcs.h"
 
 #define PRESS_THRESHOLD    4             // Minimum of 2ms delay to register press.
 #define ON_TIME            6
 #define CYCLE_TIME         100
 
+#define PAD_PINS           (BIT2 + BIT3 + BIT4 + BIT5 + BIT6)
+#define PRESS_CYCLES       32000         // Minimum of 2ms delay to register press.
+#define NO_EDGE            0xFFFF        // Pulse not received while it was on.
+#define OSC_DROP_SHIFT     5             // Press when the count drops by 1/32.
+
+/* Baseline tracking */
+#define CAL_SHIFT          3             // Boot calibration over 8 scans.
+#define BASE_SHIFT         4             // Fraction bits of the baselines.
+#define DRIFT_SHIFT        6             // Baseline follows 1/64 of each idle scan.
+#define NOISE_SHIFT        4             // Noise follows 1/16 of each idle scan.
+#define NOISE_MARGIN_SHIFT 2             // Press above 4 times the noise.
+#define IIR_SHIFT          2             // CAP_FILTER_IIR follows 1/4 of each scan.
+
+/* Change of a measurement toward a touch, and the smallest change that
+ * counts as a press whatever the noise.
+ */
+#if CAP_SENSE_MODE == CAP_SENSE_PINOSC
+#define TOUCH_DELTA(raw, base)  ((long)(base) - (long)(raw))
+#define MIN_PRESS_DELTA(base)   ((base) >> OSC_DROP_SHIFT)
+#elif CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+#define TOUCH_DELTA(raw, base)  ((long)(raw) - (long)(base))
+#define MIN_PRESS_DELTA(base)   PRESS_CYCLES
+#else
+#define TOUCH_DELTA(raw, base)  ((long)(raw) - (long)(base))
+#define MIN_PRESS_DELTA(base)   (PRESS_THRESHOLD - 1)
+#endif
+
+/* Pulse timing on TA1 in SMCLK cycles. The pulse is on for up to ON_TIME + 1
+ * ticks of TA0 out of every CYCLE_TIME.
+ */
+#define TICK_CYCLES        (INTERRUPT_INTERVAL + 1UL)
+#define ON_CYCLES          ((ON_TIME + 1) * TICK_CYCLES)
+#define CYCLE_CYCLES       (CYCLE_TIME * TICK_CYCLES)
+#define MAX_EDGE_STEP      0xF000        // Longest TA1CCR1 step, in cycles.
+
+/* Pipelined scans: once every pad received the pulse it falls EDGE_LEAD
+ * cycles later, and the pads discharge for twice as long as the pulse was
+ * on, at least one TA0 tick, before the next one. Pulses some pad did not
+ * receive in time keep the full CYCLE_TIME.
+ */
+#define ALL_PADS           0x1F
+#define EDGE_LEAD          32            // Cycles to write TA1CCR1 before TA1R.
+#define DISCHARGE_SHIFT    1
+#define HOP_STEPS          8             // CAP_SENSE_HOP periods, a power of 2.
+
 unsigned int pulse_time = 0;
 
 /* Button state variables: 0 - Up   1 - Right   2 - Down    3 - Left    4 - Middle */
 uint8_t pulse_rx = 0x00;    // Flags representing propagated pulse rx.
 
+#if CAP_SENSE_SLICED
+/* rx_time of all capacitive buttons as vertical counters: bit n of
+ * rx_planes[i] is bit i of the count of button n. Counts stay below
+ * CYCLE_TIME, as the pulse restarts them at least that often.
+ */
+#define RX_PLANES          7
+#if CYCLE_TIME >= (1 << RX_PLANES)
+#error CYCLE_TIME does not fit in RX_PLANES bit planes!
+#endif
+
+uint8_t rx_planes[RX_PLANES] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+#else
 /* rx_time for each capacitive button (in .1ms). */
 uint8_t rx_times[5] = {0x00, 0x00, 0x00, 0x00, 0x00};
+#endif
+
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+/* Delay from the pulse to the rising edge of each capacitive button, in
+ * SMCLK cycles. NO_EDGE until the pulse is received.
+ */
+uint16_t pad_delays[5] = {0, 0, 0, 0, 0};
+#endif
+
+/* Measurement state of each capacitive button.
+ * 0 - Up   1 - Right   2 - Down    3 - Left    4 - Middle
+ */
+PAD pads[5];
+
+static uint32_t pad_base[5];        // Baselines with BASE_SHIFT fraction bits.
+static uint32_t pad_noise[5];       // Noise with BASE_SHIFT fraction bits.
+static uint16_t cal_min[5];
+static uint16_t cal_max[5];
+static uint8_t cal_scans = 0;       // Scans taken, up to the calibration.
+static uint8_t debounce_scans[5];   // Scans a new press state persisted.
+#if CAP_SENSE_FILTER == CAP_FILTER_MEDIAN
+static uint16_t filter_history[5][2];
+#elif CAP_SENSE_FILTER == CAP_FILTER_IIR
+static uint32_t filter_average[5];  // Average with BASE_SHIFT fraction bits.
+#endif
+static volatile uint8_t pads_pressed = 0x00;
+
+/* Press and release events, written by the sensing interrupt at
+ * touch_head and read by the main loop at touch_tail. Each index is only
+ * written by one side, so no locking is needed.
+ */
+#define TOUCH_QUEUE_SIZE   16            // Power of 2.
+
+static volatile TOUCH_EVENT touch_queue[TOUCH_QUEUE_SIZE];
+static volatile uint8_t touch_head = 0;
+static volatile uint8_t touch_tail = 0;
+unsigned int touch_overflows = 0;   // Events dropped on a full queue.
+
+#if CAP_SENSE_MODE != CAP_SENSE_POLL
+/* refresh_count() when the scan being measured started. The TX interrupt
+ * of an LED frame holds the interrupts that time a scan off for up to an
+ * LED, far more than a touch changes them by, so scans a frame overlapped
+ * are dropped.
+ */
+static unsigned int scan_frames = 0;
+
+/* Returns 1 if an LED frame was sent at some time since the scan started. */
+static unsigned int
+frame_overlapped()
+{
+    return (scan_frames & 1) || refresh_count() != scan_frames;
+}
+#endif
+
+#if CAP_SENSE_MODE == CAP_SENSE_PINOSC
+static uint8_t osc_pad = 4;         // Pad oscillating into TA0.
+#else
+static uint8_t pulse_on = 0;        // P2.1 level after the last pulse edge.
+static uint32_t edge_wait = 0;      // Cycles from TA1CCR1 to the next edge.
+static uint16_t pulse_start;        // TA1R when the pulse was sent.
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+static uint8_t scan_clean = 1;      // No frame overlapped the last pulse.
+#endif
+
+/* Moves the falling edge of the pulse up to now once every pad received
+ * it, unless the edge is due sooner anyway.
+ *
+ * Should TA1R pass the new compare before it is written, the output unit
+ * would only drop P2.1 a full wrap of TA1 later. The pulse is then ended
+ * in OUTMOD_0 and the TA1 CCR1 interrupt is raised to handle the edge.
+ */
+static void
+end_pulse_early()
+{
+    uint16_t fall = TA1R + EDGE_LEAD;
+    
+    if (pulse_rx != ALL_PADS || !pulse_on || edge_wait) return;
+    if ((int16_t)(TA1CCR1 - fall) <= 0) return;
+    
+    TA1CCR1 = fall;
+    if ((int16_t)(TA1R - fall) >= 0) TA1CCTL1 = OUTMOD_0 + CCIE + CCIFG;
+}
+#endif
+
+/* Derives the press and release thresholds of a pad from its noise. */
+static void
+set_thresholds(PAD *pad)
+{
+    uint32_t press = (uint32_t)pad->noise << NOISE_MARGIN_SHIFT;
+    uint16_t min_press = MIN_PRESS_DELTA(pad->baseline);
+    
+    pad->press_threshold = press > min_press ? press : min_press;
+    pad->release_threshold = pad->press_threshold >> 1;
+}
+
+#if CAP_SENSE_FILTER == CAP_FILTER_MEDIAN
+/* Returns the median of 3 measurements. */
+static uint16_t
+median3(uint16_t a, uint16_t b, uint16_t c)
+{
+    uint16_t swap;
+    
+    if (a > b) {
+        swap = a;
+        a = b;
+        b = swap;
+    }
+    if (c <= a) return a;
+    if (c >= b) return b;
+    return c;
+}
+#endif
+
+/* Runs the raw measurement of each pad through the CAP_SENSE_FILTER stage
+ * into its filtered measurement. The first scan that is not dropped fills
+ * the filter state.
+ */
+static void
+filter_pads()
+{
+    int pad;
+    
+    for (pad = 0; pad < 5; pad++) {
+        uint16_t raw = pads[pad].raw;
+#if CAP_SENSE_FILTER == CAP_FILTER_MEDIAN
+        uint16_t *history = filter_history[pad];
+        
+        if (cal_scans <= 1) {
+            history[0] = raw;
+            history[1] = raw;
+        }
+        pads[pad].filtered = median3(history[0], history[1], raw);
+        history[0] = history[1];
+        history[1] = raw;
+#elif CAP_SENSE_FILTER == CAP_FILTER_IIR
+        uint32_t sample = (uint32_t)raw << BASE_SHIFT;
+        
+        if (cal_scans <= 1) {
+            filter_average[pad] = sample;
+        } else if (sample > filter_average[pad]) {
+            filter_average[pad] += (sample - filter_average[pad]) >> IIR_SHIFT;
+        } else {
+            filter_average[pad] -= (filter_average[pad] - sample) >> IIR_SHIFT;
+        }
+        pads[pad].filtered = (filter_average[pad] + (1 << (BASE_SHIFT - 1))) >> BASE_SHIFT;
+#else
+        pads[pad].filtered = raw;
+#endif
+    }
+}
+
+/* Boot calibration: averages the first scans into the baselines, with
+ * their spread as the initial noise. The very first scan may not have
+ * been measured completely and is dropped.
+ */
+static void
+calibrate_pads()
+{
+    int pad;
+    
+    for (pad = 0; pad < 5; pad++) {
+        uint16_t raw = pads[pad].filtered;
+        
+        if (cal_scans == 1) {
+            pad_base[pad] = 0;
+            cal_min[pad] = raw;
+            cal_max[pad] = raw;
+        }
+        if (cal_scans) {
+            pad_base[pad] += raw;
+            if (raw < cal_min[pad]) cal_min[pad] = raw;
+            if (raw > cal_max[pad]) cal_max[pad] = raw;
+        }
+        if (cal_scans == 1 << CAL_SHIFT) {
+            pad_base[pad] <<= BASE_SHIFT - CAL_SHIFT;
+            pad_noise[pad] = (uint32_t)(cal_max[pad] - cal_min[pad]) << (BASE_SHIFT - 1);
+            pads[pad].baseline = pad_base[pad] >> BASE_SHIFT;
+            pads[pad].noise = pad_noise[pad] >> BASE_SHIFT;
+            set_thresholds(&pads[pad]);
+        }
+    }
+    cal_scans++;
+}
+
+/* Queues a change of the pressed pads. The event is written before
+ * touch_head is advanced, so the main loop never sees it half written.
+ */
+static void
+push_touch_event(uint8_t state, uint8_t changed)
+{
+    uint8_t head = touch_head;
+    uint8_t next = (head + 1) & (TOUCH_QUEUE_SIZE - 1);
+    
+    if (next == touch_tail) {
+        touch_overflows++;
+        return;
+    }
+    touch_queue[head].time = timer_now();
+    touch_queue[head].state = state;
+    touch_queue[head].changed = changed;
+    touch_head = next;
+}
+
+/* Updates the value pointed to by "button_state" from the raw
+ * measurements of a finished scan in "pads".
+ *
+ * A pad is pressed once the delta of its filtered measurement from the
+ * baseline exceeds the press threshold and released once it falls to the
+ * release threshold, in both cases for CAP_SENSE_DEBOUNCE scans in a
+ * row. While a pad is released, its baseline follows slow drift such as temperature
+ * and humidity with a fixed-point exponential average, and its noise
+ * (the mean deviation from the baseline) sets the thresholds.
+ */
+static void
+update_pads(volatile uint8_t *btn_state)
+{
+    uint8_t new_state = 0x00;
+    int pad;
+    
+    filter_pads();
+    if (cal_scans <= 1 << CAL_SHIFT) {
+        calibrate_pads();
+        return;
+    }
+    
+    for (pad = 4; pad >= 0; pad--) {
+        PAD *p = &pads[pad];
+        uint32_t raw = (uint32_t)p->filtered << BASE_SHIFT;
+        long delta = TOUCH_DELTA(p->filtered, p->baseline);
+        uint8_t was_pressed = (pads_pressed >> pad) & 1;
+        uint8_t touched;
+        uint32_t deviation;
+        
+        p->delta = delta > 0 ? delta : 0;
+        touched = p->delta > p->press_threshold
+                || (p->delta > p->release_threshold && was_pressed);
+        
+        // Keep the old state until the new one persisted.
+        new_state <<= 1;
+        if (touched == was_pressed || ++debounce_scans[pad] >= CAP_SENSE_DEBOUNCE) {
+            debounce_scans[pad] = 0;
+            new_state |= touched;
+        } else {
+            new_state |= was_pressed;
+        }
+        // Only track clearly untouched measurements, so a touch ramping
+        // in through the filter is not taken into the baseline.
+        if (touched || p->delta > p->release_threshold) continue;
+        
+        // Released: track the baseline and the noise.
+        deviation = raw > pad_base[pad] ? raw - pad_base[pad] : pad_base[pad] - raw;
+        if (raw > pad_base[pad]) {
+            pad_base[pad] += deviation >> DRIFT_SHIFT;
+        } else {
+            pad_base[pad] -= deviation >> DRIFT_SHIFT;
+        }
+        if (deviation > pad_noise[pad]) {
+            pad_noise[pad] += (deviation - pad_noise[pad]) >> NOISE_SHIFT;
+        } else {
+            pad_noise[pad] -= (pad_noise[pad] - deviation) >> NOISE_SHIFT;
+        }
+        p->baseline = pad_base[pad] >> BASE_SHIFT;
+        p->noise = pad_noise[pad] >> BASE_SHIFT;
+        set_thresholds(p);
+    }
+    if (new_state != pads_pressed) {
+        push_touch_event(new_state, new_state ^ pads_pressed);
+    }
+    pads_pressed = new_state;
+    *btn_state = new_state;
+    gesture_update(new_state, timer_now());
+}
+
+/* Takes the oldest queued touch event into "event". Returns 0 if there is
+ * none.
+ */
+unsigned int
+touch_event(TOUCH_EVENT *event)
+{
+    uint8_t tail = touch_tail;
+    
+    if (tail == touch_head) return 0;
+    *event = touch_queue[tail];
+    touch_tail = (tail + 1) & (TOUCH_QUEUE_SIZE - 1);
+    return 1;
+}
+
+/* Returns the pads pressed by the oldest queued press, skipping releases,
+ * or 0 if no press is queued.
+ */
+uint8_t
+touch_press()
+{
+    TOUCH_EVENT event;
+    
+    while (touch_event(&event)) {
+        if (event.changed & event.state) return event.changed & event.state;
+    }
+    return 0;
+}
+
+/* Drops all queued touch events. */
+void
+touch_flush()
+{
+    touch_tail = touch_head;
+}
+
+/* Returns the currently pressed pads. */
+uint8_t
+touch_state()
+{
+    return pads_pressed;
+}
+
+/* Copies "pads" into "copy" with interrupts disabled, so no scan updates
+ * it halfway.
+ */
+void
+pad_snapshot(PAD *copy)
+{
+    int pad;
+    
+    __bic_SR_register(GIE);
+    for (pad = 0; pad < 5; pad++) {
+        copy[pad] = pads[pad];
+    }
+    __bis_SR_register(GIE);
+}
+
+/* Returns 1 once the boot calibration is done and buttons are reported. */
+unsigned int
+pads_calibrated()
+{
+    return cal_scans > 1 << CAL_SHIFT;
+}
 
 /* Read from P2IN to detect pin input voltage and store the state of all
  * capacitive buttons in the 5 LSBs of a single byte to recognize received
@@ -43,69 +440,244 @@ raw_button_state()
 }
 
 
-/* Detects and handles capacitive touch PWM pulse reception.
- * Triggered by TA0 interrupt.
- * Upon new pulse transmission ("pulse_time" is reset to 0), the rx_times of the
- * previous pulses are filtered to updated the value pointed to by "button_state" 
- * representing button presses in the order:
- * 0 - Up   1 - Right   2 - Down    3 - Left    4 - Middle.
+
+/* Records the rising edges of the pads that received the pulse.
+ * Triggered by the port 2 interrupt in CAP_SENSE_CAPTURE mode.
  *
- * Otherwise, detect new pulse reception and update rx_times for every unreceived pulse.
+ * The pulse rose at "pulse_start" on TA1, which runs continuously, so the
+ * delay is TA1R minus that. Each pad interrupts once per pulse. The delay
+ * includes the latency of this interrupt, which is exact to a few cycles
+ * unless the LED transmit holds it off, so pulses an LED frame overlapped
+ * are not published.
  */
 void
-check_pulse(uint8_t *btn_state)
+pad_edge()
 {
-    // A new pulse has been sent.
-    if (!pulse_time) {
-        // Convert previous rx_times to button press state.
-        uint8_t new_state = 0x00;
-        
-        /* Update button press state based on previous rx times.
-         * 0 - Up   1 - Right   2 - Down    3 - Left    4 - Middle
-         */
-        new_state |= (rx_times[4] > PRESS_THRESHOLD);
-        new_state <<= 1;
-        
-        new_state |= (rx_times[3] > PRESS_THRESHOLD);
-        new_state <<= 1;
-        
-        new_state |= (rx_times[2] > PRESS_THRESHOLD);
-        new_state <<= 1;
-        
-        new_state |= (rx_times[1] > PRESS_THRESHOLD);
-        new_state <<= 1;
-        
-        new_state |= (rx_times[0] > PRESS_THRESHOLD);
-        *btn_state = new_state;
-        
-        // Reset pulse rx flags and times.
-        pulse_rx = 0x00;
-        int rx_idx;
-        for (rx_idx = 4; rx_idx >= 0; rx_idx--) {
-            rx_times[rx_idx] = 0x01;
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+    uint16_t delay = TA1R - pulse_start;
+    uint8_t edges = P2IFG & PAD_PINS;
+    int pad;
+    
+    P2IFG &= ~edges;
+    P2IE &= ~edges;
+    
+    edges >>= 2;
+    pulse_rx |= edges;
+    for (pad = 0; pad < 5; pad++) {
+        if (edges & (1 << pad)) pad_delays[pad] = delay;
+    }
+    end_pulse_early();
+#endif
+}
+
+
+#if CAP_SENSE_MODE == CAP_SENSE_PINOSC
+/* Measures the capacitive buttons with their PinOsc oscillators.
+ * Triggered by TA1 CCR1 interrupt every 1ms, which gates one pad at a time
+ * into TA0: the count of the pad that oscillated since the last call is
+ * stored and the next pad is switched in.
+ *
+ * Once every pad has been counted, the value pointed to by "button_state"
+ * is updated by update_pads(). A touch lowers the count, by at least 1/32
+ * of the baseline for a press.
+ */
+void
+check_pulse(volatile uint8_t *btn_state)
+{
+    // Halt TA0 so the count can be read.
+    TA0CTL &= ~MC_3;
+    pads[osc_pad].raw = TA0R;
+    
+    // Switch the next pad's oscillator in and count from 0.
+    if (++osc_pad == 5) osc_pad = 0;
+    P2SEL2 = (P2SEL2 & ~PAD_PINS) | (BIT2 << osc_pad);
+    TA0CTL |= TACLR + MC_2;
+    
+    if (!osc_pad) {
+        if (!frame_overlapped()) update_pads(btn_state);
+        scan_frames = refresh_count();
+    }
+}
+#else
+/* Updates the value pointed to by "button_state" from the pad delays of
+ * the last pulse and starts measuring the new one, which rose at TA1CCR1.
+ */
+static void
+start_scan(volatile uint8_t *btn_state)
+{
+    int pad;
+    
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+    if (scan_clean) {
+        for (pad = 0; pad < 5; pad++) {
+            pads[pad].raw = pad_delays[pad];
         }
+        update_pads(btn_state);
+    }
+    for (pad = 0; pad < 5; pad++) {
+        pad_delays[pad] = NO_EDGE;
+    }
+    scan_frames = refresh_count();
+    
+    // Enable one rising edge interrupt per pad for the new pulse. Edges
+    // since the rise are already latched in P2IFG.
+    pulse_rx = 0x00;
+    P2IE |= PAD_PINS;
+#elif CAP_SENSE_SLICED
+    // Transpose the bit planes back into one count per pad.
+    for (pad = 0; pad < 5; pad++) {
+        uint16_t count = 0;
+        int plane;
         
-        P2OUT |= BIT1; //Send pulse
-        pulse_time++;
-        return;
+        for (plane = RX_PLANES - 1; plane >= 0; plane--) {
+            count = (count << 1) | ((rx_planes[plane] >> pad) & 1);
+        }
+        pads[pad].raw = count;
     }
-    pulse_time++;
+    update_pads(btn_state);
     
-    // Set output low to turn off the pulse after ON_TIME ms.
-    if(pulse_time > ON_TIME)
-    {
-        P2OUT &= ~BIT1;
+    // Start every count at 1.
+    rx_planes[0] = ALL_PADS;
+    for (pad = 1; pad < RX_PLANES; pad++) {
+        rx_planes[pad] = 0x00;
     }
+    
+    pulse_rx = 0x00;
+    pulse_time = 1;
+    TA0CTL |= TACLR;
+#else
+    for (pad = 0; pad < 5; pad++) {
+        pads[pad].raw = rx_times[pad];
+        rx_times[pad] = 0x01;
+    }
+    update_pads(btn_state);
+    
+    // Count the rx_times in TA0 ticks from the pulse edge.
+    pulse_rx = 0x00;
+    pulse_time = 1;
+    TA0CTL |= TACLR;
+#endif
+}
 
-    // After CYCLE_TIME, reset the pulse.
-    if(pulse_time >= CYCLE_TIME)
-    {
-        pulse_time = 0;
+#if CAP_SENSE_HOP
+/* Returns extra off cycles hopped between, so the scan period does not
+ * lock on to mains hum or the LED supply. The uneven steps of up to one
+ * TA0 tick are picked by the LFSR of rand32(). It has its own state, as
+ * the game's sequence isn't safe to step from an interrupt.
+ */
+static uint16_t
+next_hop()
+{
+    static const uint16_t hop_cycles[HOP_STEPS] = {
+        0, 1031, 2063, 3089, 4111, 5147, 6173, 7193
+    };
+    static unsigned int lfsr = 0x0005;
+    unsigned int new_bit;
+    
+    /* taps: 16 14 13 11; feedback polynomial: x^16 + x^14 + x^13 + x^11 + 1 */
+    new_bit = ((lfsr >> 0) ^ (lfsr >> 2) ^ (lfsr >> 3) ^ (lfsr >> 5)) & 1;
+    lfsr = (lfsr >> 1) | (new_bit << 15);
+    
+    return hop_cycles[lfsr & (HOP_STEPS - 1)];
+}
+#else
+#define next_hop()  0
+#endif
+
+/* Cycles the pulse stays off after it was on for "on_cycles", plus the
+ * hop. Pulses stay within CYCLE_TIME.
+ */
+static uint32_t
+off_cycles(uint16_t on_cycles)
+{
+    uint32_t discharge = (uint32_t)on_cycles << DISCHARGE_SHIFT;
+    uint16_t hop = next_hop();
+    
+    if (pulse_rx != ALL_PADS) return CYCLE_CYCLES - ON_CYCLES - hop;
+    return (discharge > TICK_CYCLES ? discharge : TICK_CYCLES) + hop;
+}
+
+/* Generates the capacitive touch pulse on P2.1 with the TA1.1 output
+ * unit. Triggered by TA1 CCR1 interrupt after every compare.
+ *
+ * Each edge is made by the output unit at the exact TA1CCR1 compare
+ * (OUTMOD_1 sets, OUTMOD_5 resets P2.1), so ISR latency does not change
+ * the pulse width. This interrupt only schedules the next edge, in steps
+ * of at most MAX_EDGE_STEP which repeat the current level. When the pulse
+ * rises, the measurement of the last pulse is published to the value
+ * pointed to by "button_state", unless an LED frame overlapped it, and a
+ * new one starts. The pulse ends early
+ * once every pad received it, so untouched pads are scanned every few
+ * TA0 ticks instead of every CYCLE_TIME.
+ */
+void
+pulse_edge(volatile uint8_t *btn_state)
+{
+    uint16_t step;
+    
+    if (!edge_wait) {
+        // The edge armed last time just happened.
+        pulse_on ^= 1;
+        if (pulse_on) {
+            pulse_start = TA1CCR1;
+            start_scan(btn_state);
+            edge_wait = ON_CYCLES;
+        } else {
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+            // Pads the pulse did not reach in time stay at NO_EDGE.
+            P2IE &= ~PAD_PINS;
+            scan_clean = !frame_overlapped();
+#endif
+            edge_wait = off_cycles(TA1CCR1 - pulse_start);
+        }
+    }
+    
+    step = edge_wait > MAX_EDGE_STEP ? MAX_EDGE_STEP : edge_wait;
+    edge_wait -= step;
+    TA1CCR1 += step;
+    
+    // Flip the level at the edge, repeat it on the steps before.
+    if (edge_wait ? pulse_on : !pulse_on) {
+        TA1CCTL1 = OUTMOD_1 + CCIE;
+    } else {
+        TA1CCTL1 = OUTMOD_5 + CCIE;
     }
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+    // Clear the pad flags before the pulse rises, so only its edges are
+    // latched until start_scan() enables them.
+    if (!edge_wait && !pulse_on) P2IFG &= ~PAD_PINS;
+#endif
+}
 
+#if CAP_SENSE_MODE == CAP_SENSE_POLL
+/* Detects capacitive touch pulse reception.
+ * Triggered by TA0 interrupt, which pulse_edge() restarts on every pulse.
+ * Updates rx_times for every unreceived pulse until the next pulse is sent.
+ */
+void
+check_pulse(volatile uint8_t *btn_state)
+{
+#if CAP_SENSE_SLICED
+    uint8_t carry;
+    int plane;
+#endif
+    
+    pulse_time++;
+    
     // Update pulse_rx to reflect all received pulses.
     raw_button_state();
     
+#if CAP_SENSE_SLICED
+    /* Increment the counts of all unreceived pulses at once by rippling
+     * their carry through the bit planes, without a branch per pad.
+     */
+    carry = ~pulse_rx & ALL_PADS;
+    for (plane = 0; plane < RX_PLANES; plane++) {
+        uint8_t next = rx_planes[plane] & carry;
+        rx_planes[plane] ^= carry;
+        carry = next;
+    }
+#else
     /* Increment rx_times for unreceived pulses until next pulse is sent.
      * 0 - Up   1 - Right   2 - Down    3 - Left    4 - Middle
      */
@@ -114,6 +686,9 @@ check_pulse(uint8_t *btn_state)
     if (!(pulse_rx & BIT2)) rx_times[2]++;
     if (!(pulse_rx & BIT3)) rx_times[3]++;
     if (!(pulse_rx & BIT4)) rx_times[4]++;
+#endif
     
+    end_pulse_early();
 }
-
+#endif
+#endif
@@ -1,20 +1,151 @@
 /*************************************************************************
  * Contains functions to detect presses based on capacticance changes.
  *
- * void check_pulse(uint8_t *button_state); 
- *      Triggered by TA0 interrupt every .1ms. Updates the value pointed to
- *      by button_state to represent the currently pressed buttons.
+ * void check_pulse(volatile uint8_t *button_state); 
+ *      Triggered by TA0 interrupt every .5ms in CAP_SENSE_POLL mode.
+ *      Counts the ticks until each pad received the pulse.
+ *      Triggered by the TA1 CCR1 interrupt every 1ms in CAP_SENSE_PINOSC mode,
+ *      where it also updates the value pointed to by button_state to
+ *      represent the currently pressed buttons.
+ *
+ * unsigned int pads_calibrated();
+ *      Returns 1 once the boot calibration of the pad baselines is done.
+ *      The pads must not be touched until then.
+ *
+ * PAD pads[5];
+ *      Raw and filtered measurement, baseline, delta, noise and thresholds
+ *      of each pad, updated once per scan.
+ *
+ * void pad_snapshot(PAD *copy);
+ *      Copies pads[] into the 5 PADs at "copy" without a scan updating it
+ *      halfway.
+ *
+ * uint8_t touch_state();
+ *      Returns the currently pressed buttons, like button_state.
+ *
+ * unsigned int touch_event(TOUCH_EVENT *event);
+ *      Takes the oldest press or release event from the queue filled by
+ *      the sensing interrupts. Returns 0 if the queue is empty. Events are
+ *      kept while the main loop is busy, so no press is lost.
+ *
+ * uint8_t touch_press();
+ *      Returns the buttons of the oldest queued press, or 0 if none. The
+ *      releases before it are dropped.
+ *
+ * void touch_flush();
+ *      Drops all queued events.
+ *
+ * void pulse_edge(volatile uint8_t *button_state);
+ *      Triggered by the TA1 CCR1 interrupt. Schedules the next edge of the
+ *      hardware pulse on P2.1 and, when the pulse rises, updates the value
+ *      pointed to by button_state from the last pulse.
  * 
  * void raw_button_state()
  *      Updates a global variable to refelct the which pulses have been
  *      received. Used to increment rx time
  *
+ * void pad_edge();
+ *      Triggered by the port 2 interrupt in CAP_SENSE_CAPTURE mode.
+ *      Timestamps the pads whose pulse arrived.
+ *
  ************************************************************************/
 
 #ifndef cap_sense_h
 #define cap_sense_h
 
 #include <stdio.h>
-void check_pulse(uint8_t *button_state);
+
+/* How the delay of the pulse to each pad is measured:
+ *  CAP_SENSE_POLL    - check_pulse() polls P2IN on every TA0 tick and
+ *                      counts the ticks until each pad received the pulse.
+ *  CAP_SENSE_CAPTURE - port 2 edge interrupts timestamp the rising edge of
+ *                      each pad against the P2.1 pulse in SMCLK cycles,
+ *                      one interrupt per pad per scan. The timestamps
+ *                      include the interrupt latency, so scans an LED
+ *                      frame overlapped are dropped.
+ *  CAP_SENSE_PINOSC  - no pulse. Each pad's PinOsc relaxation oscillator
+ *                      clocks TA0 for a 1ms window; touching the pad
+ *                      lowers the count. check_pulse() is triggered by
+ *                      the TA1 CCR1 interrupt instead, and drops scans
+ *                      whose windows an LED frame overlapped.
+ */
+#define CAP_SENSE_POLL      0
+#define CAP_SENSE_CAPTURE   1
+#define CAP_SENSE_PINOSC    2
+
+#ifndef CAP_SENSE_MODE
+#define CAP_SENSE_MODE CAP_SENSE_POLL
+#endif
+
+/* 1 to keep the CAP_SENSE_POLL rx_times as bit-sliced vertical counters,
+ * so check_pulse() increments all pads with the same few bitwise
+ * operations instead of a branch per pad.
+ */
+#ifndef CAP_SENSE_SLICED
+#define CAP_SENSE_SLICED 0
+#endif
+
+/* 1 to hop the time between pulses of CAP_SENSE_POLL and
+ * CAP_SENSE_CAPTURE pseudo-randomly, so periodic noise does not alias
+ * into the same phase of every scan. The filter combines the scans.
+ */
+#ifndef CAP_SENSE_HOP
+#define CAP_SENSE_HOP 1
+#endif
+
+/* Filter applied to each pad measurement before the press decision:
+ *  CAP_FILTER_NONE   - the measurement of the last scan.
+ *  CAP_FILTER_MEDIAN - median of the last 3 scans; rejects single noisy
+ *                      scans at the cost of one scan of latency.
+ *  CAP_FILTER_IIR    - fixed-point exponential average over about 4 scans.
+ * A changed press state must also persist for CAP_SENSE_DEBOUNCE scans.
+ */
+#define CAP_FILTER_NONE     0
+#define CAP_FILTER_MEDIAN   1
+#define CAP_FILTER_IIR      2
+
+#ifndef CAP_SENSE_FILTER
+#define CAP_SENSE_FILTER CAP_FILTER_MEDIAN
+#endif
+
+#ifndef CAP_SENSE_DEBOUNCE
+#define CAP_SENSE_DEBOUNCE 2
+#endif
+
+/* Measurement state of a capacitive button, updated once per scan. Values
+ * are in the units of the sensing mode: TA0 ticks, SMCLK cycles or PinOsc
+ * periods.
+ */
+typedef struct {
+    uint16_t raw;               // Measurement of the last scan.
+    uint16_t filtered;          // Output of the CAP_SENSE_FILTER stage.
+    uint16_t baseline;          // Untouched measurement, tracks slow drift.
+    uint16_t delta;             // Change from the baseline toward a touch.
+    uint16_t noise;             // Mean deviation from the baseline.
+    uint16_t press_threshold;   // Delta above which the button is pressed.
+    uint16_t release_threshold; // Delta at which it is released again.
+} PAD;
+
+/* A change of the pressed buttons. The pressed ones are changed & state,
+ * the released ones changed & ~state.
+ */
+typedef struct {
+    uint32_t time;              // timer_now() when the change was measured.
+    uint8_t state;              // Pressed buttons after the change.
+    uint8_t changed;            // Buttons pressed or released.
+} TOUCH_EVENT;
+
+extern PAD pads[5];
+extern unsigned int touch_overflows;
+
+void check_pulse(volatile uint8_t *button_state);
+unsigned int pads_calibrated();
+void pad_snapshot(PAD *copy);
+uint8_t touch_state();
+unsigned int touch_event(TOUCH_EVENT *event);
+uint8_t touch_press();
+void touch_flush();
+void pulse_edge(volatile uint8_t *button_state);
 void raw_button_state();
+void pad_edge();
 #endif /* cap_sense_h */
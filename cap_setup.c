@@ -1,8 +1,10 @@
-#include <msp430.h>
+#include "hal.h"
+#include <stdint.h>
 
+#include "cap_sense.h"
 #include "cap_setup.h"
-
-#define INTERRUPT_INTERVAL 8000            // Interrupt every .5ms for timing.
+#include "led_control.h"
+#include "timing_funcs.h"
 
 /*
  * Setup Clocks, Timers, and SPI protocol.
@@ -21,21 +23,28 @@ setup()
     
     setup_spi();                                    // Setup the MSP430 to transmit over SPI
     
+#if CAP_SENSE_MODE == CAP_SENSE_PINOSC
+    /* Setup TA0 to count the PinOsc of the pad being measured. */
+    TA0CTL |= TASSEL_3 + MC_2 + ID_0;               // Source from INCLK, Continuous Mode
+#elif CAP_SENSE_MODE == CAP_SENSE_POLL
     /* Setup TA0 to generate interrupts. */
     TA0CTL |= TASSEL_2 + MC_1 + ID_0;               // Source from SMCLK, Up Mode
     
     TA0CCTL0 |= CCIE;                               // CCR0 interrupt enabled.
     TA0CCR0 = INTERRUPT_INTERVAL;                   // Interrupt in .5ms.
+#endif
     
-    /* Setup TA1 to generate interrupts. */
-    TA1CTL |= TASSEL_2 + MC_1 + ID_0;               // Source from SMCLK, Up Mode
-    
-    TA1CCTL0 |= CCIE;                               // CCR0 interrupt enabled.
-    TA1CCR0 = 16000;                                // Interrupt in 1ms.
+    /* Setup TA1 as the time base. It runs freely so every compare
+     * channel can schedule its own events; CCR0 is armed by wait(). */
+    TA1CTL |= TASSEL_2 + MC_2 + ID_0 + TAIE;        // Source from SMCLK, Continuous Mode
     
     /* Set all capacitive buttons to inputs and enable pull up resistors. */
     /* Up - P2.2  Right - P2.3  Down - P2.4 Left - P2.5  Middle - P2.6 */
     P2DIR &= ~(BIT2 + BIT3 + BIT4 + BIT5 + BIT6);   // Set input direction
+#if CAP_SENSE_MODE == CAP_SENSE_CAPTURE
+    P2IES &= ~(BIT2 + BIT3 + BIT4 + BIT5 + BIT6);   // Flag rising edges
+    P2IFG &= ~(BIT2 + BIT3 + BIT4 + BIT5 + BIT6);   // Clear flags left by reset
+#endif
 
     /* Set all LEDs to output and intialize to off. */
     /* Up - P3.2  Right - P3.3  Down - P3.4  Left - P3.5  Middle P3.6 */
@@ -46,11 +55,22 @@ setup()
     P2DIR |= BIT1;                            // P2.1 to output (corresponds to TA1CCR1).
     P2SEL &= ~BIT6;
     P2SEL2 &= ~BIT6;
+    
+#if CAP_SENSE_MODE == CAP_SENSE_PINOSC
+    TA1CCR1 = TICK_INTERVAL;                  // First PinOsc window ends in 1ms.
+    TA1CCTL1 = CCIE;
+#else
+    P2SEL |= BIT1;                            // P2.1 driven by the TA1.1 output unit.
+    TA1CCR1 = INTERRUPT_INTERVAL;             // First pulse in .5ms.
+    TA1CCTL1 = OUTMOD_1 + CCIE;               // Set P2.1 at the compare.
+#endif
 }
 
 /*
  * Configures the MSP430 to use USCI Module A to transmit SPI
  * Sets P1.2 as MOSI and P1.4 as CLK.
+ * With SPI_CHANNELS set to 2, also configures USCI Module B the same way
+ * for the second panel, with P1.7 as SIMO and P1.5 as CLK.
  */
 void
 setup_spi()
@@ -61,7 +81,7 @@ setup_spi()
     
     UCA0MCTL = 0;                                 // No modulation
     UCA0CTL1 |= UCSSEL_2;                         // SMCLK
-    UCA0BR0 = 3;                                  // 16 MHz / 3 = .1875 us per bit
+    UCA0BR0 = SPI_DIVIDER;                        // 16 MHz / 3 = .1875 us per bit
     UCA0BR1 = 0;
     
     P1DIR = BIT2 + BIT4;                          // Set P1.2 and P1.4 to output
@@ -70,4 +90,18 @@ setup_spi()
     P1SEL2 = BIT2 + BIT4;                         //P1.2 as MOSI and P1.4 as CLK
     
     UCA0CTL1 &= ~UCSWRST;                         //Initialize USCI state machine - active low
+    
+#if SPI_CHANNELS == 2
+    UCB0CTL1 |= UCSWRST;                          // Put USCI_B state machine in reset
+    UCB0CTL0 |= UCCKPH | UCMSB | UCMST | UCSYNC;  // 3-pin, 8-bit MSB first, SPI master
+    UCB0CTL1 |= UCSSEL_2;                         // SMCLK
+    UCB0BR0 = SPI_DIVIDER;                        // Same bit time as USCI_A0
+    UCB0BR1 = 0;
+    
+    P1DIR |= BIT5 + BIT7;                         // Set P1.5 and P1.7 to output
+    P1SEL |= BIT5 + BIT7;                         //P1.7 as SIMO and P1.5 as CLK
+    P1SEL2 |= BIT5 + BIT7;
+    
+    UCB0CTL1 &= ~UCSWRST;                         //Initialize USCI state machine - active low
+#endif
 }
@@ -11,6 +11,9 @@
 
 #include <stdio.h>
 
+#define INTERRUPT_INTERVAL 8000            // Interrupt every .5ms for timing.
+#define TICK_INTERVAL      16000           // TA1 CCR1 steps of 1ms for PinOsc.
+
 void setup();
 void setup_spi();
 
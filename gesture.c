@@ -0,0 +1,147 @@
+#include "hal.h"
+#include <stdint.h>
+
+#include "gesture.h"
+#include "timing_funcs.h"
+
+#define LONG_PRESS_MS      800           // Hold to register a long press.
+#define TAP_MS             250           // Longest press that is a tap.
+#define DOUBLE_TAP_MS      300           // Longest gap between two taps.
+#define SWIPE_MS           400           // Longest step of a swipe.
+#define CHORD_MS           80            // Longest gap between chord presses.
+
+#define MIDDLE             BIT4
+#define OUTER_BUTTONS      (BIT0 + BIT1 + BIT2 + BIT3)
+
+/* Opposite outer button: Up <-> Down, Right <-> Left. */
+#define OPPOSITE(button)   ((((button) << 2) | ((button) >> 2)) & OUTER_BUTTONS)
+
+/* Returns 1 if "buttons" has exactly one or exactly two buttons. */
+#define ONE_BUTTON(buttons)   ((buttons) && !((buttons) & ((buttons) - 1)))
+#define TWO_BUTTONS(buttons)  ((buttons) && ONE_BUTTON((buttons) & ((buttons) - 1)))
+
+/* Recognized gestures, written by the sensing interrupt at gesture_head
+ * and read by the main loop at gesture_tail, like the touch events.
+ */
+#define GESTURE_QUEUE_SIZE 8             // Power of 2.
+
+static volatile GESTURE gesture_queue[GESTURE_QUEUE_SIZE];
+static volatile uint8_t gesture_head = 0;
+static volatile uint8_t gesture_tail = 0;
+
+/* State machine: a fixed set of variables, whatever the input. */
+static uint8_t held = 0x00;         // Buttons pressed at the last update.
+static uint8_t press_buttons = 0;   // Buttons of the last press.
+static uint32_t press_time;
+static uint8_t long_sent = 0;       // The last press was reported as long.
+static uint8_t tap_button = 0;      // Button of an unpaired tap.
+static uint32_t tap_time;
+static uint8_t swipe_from = 0;      // Outer button a swipe started on.
+static uint8_t swipe_step = 0;      // Buttons of the swipe pressed so far.
+static uint32_t swipe_time;
+
+/* Queues a gesture. Dropped if the main loop left the queue full. */
+static void
+push_gesture(uint8_t type, uint8_t buttons, uint32_t now)
+{
+    uint8_t head = gesture_head;
+    uint8_t next = (head + 1) & (GESTURE_QUEUE_SIZE - 1);
+    
+    if (next == gesture_tail) return;
+    gesture_queue[head].time = now;
+    gesture_queue[head].type = type;
+    gesture_queue[head].buttons = buttons;
+    gesture_head = next;
+}
+
+/* Follows a swipe through the middle with the newly pressed "button". */
+static void
+swipe_press(uint8_t button, uint32_t now)
+{
+    unsigned int in_time = now - swipe_time <= SWIPE_MS * MS_CYCLES;
+    
+    if (swipe_step == 1 && button == MIDDLE && in_time) {
+        swipe_step = 2;
+    } else if (swipe_step == 2 && button == OPPOSITE(swipe_from) && in_time) {
+        push_gesture(GESTURE_SWIPE, button, now);
+        swipe_step = 0;
+    } else if (button & OUTER_BUTTONS) {
+        swipe_from = button;
+        swipe_step = 1;
+    } else {
+        swipe_step = 0;
+    }
+    swipe_time = now;
+}
+
+/* Pairs the tap of "button" with the previous one. */
+static void
+tap(uint8_t button, uint32_t now)
+{
+    if (button == tap_button && now - tap_time <= DOUBLE_TAP_MS * MS_CYCLES) {
+        push_gesture(GESTURE_DOUBLE_TAP, button, now);
+        tap_button = 0;
+    } else {
+        tap_button = button;
+        tap_time = now;
+    }
+}
+
+/* Advances the gesture state machine with the buttons pressed after a
+ * scan, at "now" in timer_now() cycles. Buttons are in the order of
+ * button_state:
+ * 0 - Up   1 - Right   2 - Down    3 - Left    4 - Middle.
+ */
+void
+gesture_update(uint8_t button_state, uint32_t now)
+{
+    uint8_t pressed = button_state & ~held;
+    uint8_t released = held & ~button_state;
+    
+    if (pressed) {
+        // A second button soon after the first, or both at once.
+        if (TWO_BUTTONS(button_state)
+                && (TWO_BUTTONS(pressed) || now - press_time <= CHORD_MS * MS_CYCLES)) {
+            push_gesture(GESTURE_CHORD, button_state, now);
+        }
+        if (ONE_BUTTON(pressed)) swipe_press(pressed, now);
+        press_buttons = pressed;
+        press_time = now;
+        long_sent = 0;
+    }
+    
+    if (released && !button_state && released == press_buttons
+            && ONE_BUTTON(released) && !long_sent
+            && now - press_time <= TAP_MS * MS_CYCLES) {
+        tap(released, now);
+    }
+    
+    if (button_state == press_buttons && ONE_BUTTON(button_state)
+            && !long_sent && now - press_time >= LONG_PRESS_MS * MS_CYCLES) {
+        push_gesture(GESTURE_LONG_PRESS, button_state, now);
+        long_sent = 1;
+    }
+    
+    held = button_state;
+}
+
+/* Takes the oldest queued gesture into "gesture". Returns 0 if there is
+ * none.
+ */
+unsigned int
+gesture_event(GESTURE *gesture)
+{
+    uint8_t tail = gesture_tail;
+    
+    if (tail == gesture_head) return 0;
+    *gesture = gesture_queue[tail];
+    gesture_tail = (tail + 1) & (GESTURE_QUEUE_SIZE - 1);
+    return 1;
+}
+
+/* Drops all queued gestures. */
+void
+gesture_flush()
+{
+    gesture_tail = gesture_head;
+}
@@ -0,0 +1,44 @@
+/*************************************************************************
+ * Recognizes gestures from the pressed state of the capacitive buttons.
+ *
+ * void gesture_update(uint8_t button_state, uint32_t now);
+ *      Called by the sensing interrupt after every scan with the pressed
+ *      buttons and timer_now(). Advances the gesture state machine and
+ *      queues the gestures it completes, so they are seen within one scan.
+ *
+ * unsigned int gesture_event(GESTURE *gesture);
+ *      Takes the oldest queued gesture. Returns 0 if there is none.
+ *
+ * void gesture_flush();
+ *      Drops all queued gestures.
+ *
+ ************************************************************************/
+
+#ifndef gesture_h
+#define gesture_h
+
+#include <stdio.h>
+
+/* Gesture types:
+ *  GESTURE_SWIPE      - an outer button, the middle and the opposite outer
+ *                       button pressed in turn. "buttons" is the last one,
+ *                       the direction of the swipe.
+ *  GESTURE_LONG_PRESS - one button held for LONG_PRESS_MS.
+ *  GESTURE_DOUBLE_TAP - one button tapped twice in a row.
+ *  GESTURE_CHORD      - two buttons pressed together. "buttons" has both.
+ */
+#define GESTURE_SWIPE       1
+#define GESTURE_LONG_PRESS  2
+#define GESTURE_DOUBLE_TAP  3
+#define GESTURE_CHORD       4
+
+typedef struct {
+    uint32_t time;              // timer_now() when the gesture completed.
+    uint8_t type;
+    uint8_t buttons;            // Buttons of the gesture, as button_state.
+} GESTURE;
+
+void gesture_update(uint8_t button_state, uint32_t now);
+unsigned int gesture_event(GESTURE *gesture);
+void gesture_flush();
+#endif /* gesture_h */
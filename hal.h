@@ -0,0 +1,29 @@
+/*************************************************************************
+ * Hardware abstraction layer.
+ *
+ * Every module includes this header instead of <msp430.h>. It selects
+ * one of two backends:
+ *
+ *  - Register backend (default): the MSP430 device header. Firmware
+ *    code accesses the peripheral registers and intrinsics directly, so
+ *    the HAL costs nothing on the target.
+ *
+ *  - Host backend (-DHOST_BUILD): "hal_host.h" provides the same register
+ *    names and intrinsics backed by a simulation of the peripherals used
+ *    by the game, so the firmware builds and runs as a Linux executable.
+ *
+ * HOST_ISR(vector, name) is only defined by the host backend and is used
+ * by the interrupt service routines in place of the compiler specific
+ * vector attributes.
+ ************************************************************************/
+
+#ifndef hal_h
+#define hal_h
+
+#if defined(HOST_BUILD)
+#include "hal_host.h"
+#else
+#include <msp430.h>
+#endif
+
+#endif /* hal_h */
@@ -0,0 +1,953 @@
+/*************************************************************************
+ * Host backend of the hardware abstraction layer.
+ *
+ * Simulates the MSP430G2553 peripherals declared in hal_host.h. Time
+ * advances in SMCLK cycles: one cycle per register access, the argument
+ * of __delay_cycles(), the cost of interrupt entry and HOST_ISR_CYCLES
+ * for the rest of every interrupt, and however long the CPU sleeps in
+ * LPM0 until an interrupt clears CPUOFF on exit.
+ *
+ * Instead of ticking every cycle, hal_host_advance() jumps straight to
+ * the next peripheral event (timer compare or wrap, end of an SPI byte,
+ * VLO edge), so long sleeps cost almost nothing to simulate.
+ ************************************************************************/
+#if defined(HOST_BUILD)
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hal_host.h"
+
+#define SMCLK_HZ           16000000UL
+#define CYCLES_PER_US      (SMCLK_HZ / 1000000UL)
+#define CYCLES_PER_MS      (SMCLK_HZ / 1000UL)
+
+#define ISR_ENTRY_CYCLES   6            // Push PC and SR, load vector.
+#define ISR_CYCLES         60           // Register saves, short body, RETI.
+#define RESET_CODE_CYCLES  800          // 50us low ends a WS2812 frame.
+#define VLO_PERIOD         1333         // 12 kHz VLO in SMCLK cycles.
+#define VLO_JITTER         64
+
+#define CHAIN_LEDS         128
+#define PANEL_LEDS         64
+#define LONG_PULSE_CYCLES  9            // High for over 550ns reads as 1.
+
+#define NUM_PADS           5
+#define PAD_SHIFT          2            // Pads are P2.2 - P2.6.
+#define EXCITATION_PIN     BIT1
+#define EDGE_HISTORY       8
+#define MAX_PRESSES        64
+
+#define NO_EVENT           UINT32_MAX
+
+struct hal_host_regs hal_host_regs;
+
+/* Timer_A instance state not held in registers. */
+struct host_timer {
+    uint16_t *ctl;
+    uint16_t *r;
+    uint16_t *cctl;
+    uint16_t *ccr;
+    uint16_t *iv;
+    uint32_t prescale;          // SMCLK cycles toward the next TAR tick.
+    unsigned long lost;         // Enabled compares dropped on a set CCIFG.
+    uint8_t out[3];             // Output unit levels.
+};
+
+/* A WS2812 chain fed by one MOSI line. Its LEDs start at LED "first" of
+ * the 128 LED grid.
+ */
+struct host_chain {
+    unsigned int first;
+    unsigned int leds;
+    uint8_t rx[CHAIN_LEDS * 3];
+    unsigned long bits;         // Bits received in this frame.
+    uint32_t high_run;          // Cycles MOSI has been high.
+    uint32_t low_run;           // Cycles MOSI has been low after a bit.
+    uint32_t longest_low;       // Longest low between two bits of a frame.
+};
+
+/* USCI SPI transmitter state not held in registers. */
+struct host_usci {
+    uint8_t *ctl1;
+    uint8_t *br0;
+    uint8_t *br1;
+    uint8_t *txbuf;
+    uint8_t txifg;
+    int write_pending;          // TXBUF was handed out for a write.
+    int buffer_full;
+    uint8_t buffered;
+    uint32_t shift_left;        // Cycles until the shift register is empty.
+    uint64_t last_end;          // Time the last byte finished shifting.
+    uint64_t frame_start;       // Time the first byte of the frame started.
+    uint64_t frame_cycles;      // Sum of the frame times.
+    unsigned long bytes;
+    unsigned long frames;
+    unsigned long frame_bytes;
+    struct host_chain *chain;
+};
+
+/* A level change of the pad excitation signal. */
+struct host_edge {
+    uint64_t time;
+    uint8_t level;
+    uint32_t delay[NUM_PADS];   // Per-pad propagation delay of this edge.
+};
+
+struct host_press {
+    uint32_t ms;
+    uint8_t mask;
+};
+
+static struct host_timer timers[2] = {
+    { &hal_host_regs.ta0ctl, &hal_host_regs.ta0r, hal_host_regs.ta0cctl,
+      hal_host_regs.ta0ccr, &hal_host_regs.ta0iv, 0, 0 },
+    { &hal_host_regs.ta1ctl, &hal_host_regs.ta1r, hal_host_regs.ta1cctl,
+      hal_host_regs.ta1ccr, &hal_host_regs.ta1iv, 0, 0 },
+};
+
+static struct host_chain chain_a0 = { 0, CHAIN_LEDS };
+static struct host_chain chain_b0 = { PANEL_LEDS, CHAIN_LEDS - PANEL_LEDS };
+
+static struct host_usci usci_a0 = {
+    &hal_host_regs.uca0ctl1, &hal_host_regs.uca0br0, &hal_host_regs.uca0br1,
+    &hal_host_regs.uca0txbuf, UCA0TXIFG, .chain = &chain_a0,
+};
+
+static struct host_usci usci_b0 = {
+    &hal_host_regs.ucb0ctl1, &hal_host_regs.ucb0br0, &hal_host_regs.ucb0br1,
+    &hal_host_regs.ucb0txbuf, UCB0TXIFG, .chain = &chain_b0,
+};
+
+static void (*vectors[HOST_NUM_VECTORS])(void);
+static unsigned long vector_count[HOST_NUM_VECTORS];
+static const char *vector_names[HOST_NUM_VECTORS] = {
+    [PORT1_VECTOR] = "PORT1",             [PORT2_VECTOR] = "PORT2",
+    [USCIAB0TX_VECTOR] = "USCIAB0TX",     [USCIAB0RX_VECTOR] = "USCIAB0RX",
+    [TIMER0_A1_VECTOR] = "TIMER0_A1",     [TIMER0_A0_VECTOR] = "TIMER0_A0",
+    [TIMER1_A1_VECTOR] = "TIMER1_A1",     [TIMER1_A0_VECTOR] = "TIMER1_A0",
+};
+
+static uint64_t now;                    // SMCLK cycles since reset.
+static uint64_t end_time;
+static uint64_t sleep_cycles;
+static uint64_t masked_cycles;          // Active cycles with GIE clear.
+static unsigned long wakeups;
+static uint32_t isr_cycles;             // Charged to every interrupt.
+
+static uint16_t sr;
+static uint16_t *exit_sr;               // Stacked SR of the running ISR.
+
+static int trace;
+static FILE *spi_log;
+static FILE *led_log;
+static unsigned long frames_shown;      // Grid frames latched on the chains.
+
+static uint8_t chain[CHAIN_LEDS * 3];   // Latched GRB of every LED.
+static uint8_t p3out_seen;
+
+/* Latency from a press shown on P3OUT to the next frame latched while it
+ * is held. Presses released before a frame are not counted.
+ */
+static int press_pending;
+static uint64_t press_time;
+static unsigned long latency_count;
+static uint64_t latency_min;
+static uint64_t latency_max;
+static uint64_t latency_sum;
+
+static uint64_t next_vlo;
+static uint32_t rng_state = 1;
+
+static struct host_edge edges[EDGE_HISTORY];
+static unsigned int edge_head;
+static uint8_t excitation;
+static uint8_t pads_seen;               // Pad pins at the last sync.
+
+static struct host_press presses[MAX_PRESSES];
+static unsigned int num_presses;
+static uint32_t pad_delay;
+static uint32_t touch_delay;
+static uint32_t pad_noise;
+static uint32_t pinosc_cycles;
+static uint32_t pinosc_touch_cycles;
+
+static void hal_host_advance(uint64_t cycles);
+
+/* xorshift32, so runs are reproducible for a given HOST_SEED. */
+static uint32_t
+host_rand(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static unsigned long
+env_number(const char *name, unsigned long fallback)
+{
+    const char *value = getenv(name);
+    return value ? strtoul(value, NULL, 0) : fallback;
+}
+
+static void
+fatal(const char *msg)
+{
+    fprintf(stderr, "host: %s at %.3f ms\n", msg,
+            (double)now / CYCLES_PER_MS);
+    exit(1);
+}
+
+
+/*********************************************************************
+ * Capacitive pads
+ *********************************************************************/
+
+/* Pads touched at the current time according to HOST_PRESS. */
+static uint8_t
+touched_pads(void)
+{
+    uint32_t ms = (uint32_t)(now / CYCLES_PER_MS);
+    uint8_t mask = 0;
+    unsigned int i;
+    for (i = 0; i < num_presses && presses[i].ms <= ms; i++) {
+        mask = presses[i].mask;
+    }
+    return mask;
+}
+
+/* Level of the pad excitation pin as driven by the port, or by the TA1.1
+ * output unit when the pin is selected for it.
+ */
+static uint8_t
+excitation_level(void)
+{
+    if (hal_host_regs.p2sel & ~hal_host_regs.p2sel2 & EXCITATION_PIN) {
+        return (hal_host_regs.p2dir & EXCITATION_PIN) && timers[1].out[1];
+    }
+    return (hal_host_regs.p2out & hal_host_regs.p2dir & EXCITATION_PIN) != 0;
+}
+
+/* Records a change of the excitation level with the delay it will take
+ * to reach each pad.
+ */
+static void
+record_edge(uint8_t level)
+{
+    struct host_edge *edge;
+    uint8_t touched = touched_pads();
+    int pad;
+
+    edge_head = (edge_head + 1) % EDGE_HISTORY;
+    edge = &edges[edge_head];
+    edge->time = now;
+    edge->level = level;
+    for (pad = 0; pad < NUM_PADS; pad++) {
+        uint32_t delay = (touched & (1 << pad)) ? touch_delay : pad_delay;
+        if (pad_noise) {
+            delay += host_rand() % (pad_noise + 1);
+        }
+        edge->delay[pad] = delay;
+    }
+    excitation = level;
+}
+
+/* Level seen on a pad's receive pin: the excitation, delayed. */
+static uint8_t
+pad_level(int pad)
+{
+    unsigned int i;
+    for (i = 0; i < EDGE_HISTORY; i++) {
+        const struct host_edge *edge =
+            &edges[(edge_head + EDGE_HISTORY - i) % EDGE_HISTORY];
+        if (edge->time + edge->delay[pad] <= now) {
+            return edge->level;
+        }
+    }
+    return 0;
+}
+
+static uint8_t
+port2_input(void)
+{
+    uint8_t pins = 0;
+    int pad;
+    for (pad = 0; pad < NUM_PADS; pad++) {
+        pins |= pad_level(pad) << (pad + PAD_SHIFT);
+    }
+    return (hal_host_regs.p2out & hal_host_regs.p2dir)
+        | (pins & ~hal_host_regs.p2dir);
+}
+
+/* SMCLK cycles per PinOsc period of the pad selected by P2SEL2 (and not
+ * P2SEL), or 0 if no pad oscillates.
+ */
+static uint32_t
+pinosc_period(void)
+{
+    uint8_t osc = hal_host_regs.p2sel2 & ~hal_host_regs.p2sel;
+    int pad;
+    for (pad = 0; pad < NUM_PADS; pad++) {
+        if (osc & (1 << (pad + PAD_SHIFT))) {
+            return (touched_pads() & (1 << pad)) ? pinosc_touch_cycles
+                                                 : pinosc_cycles;
+        }
+    }
+    return 0;
+}
+
+/* Sets P2IFG for the pad pins that changed since the last call in the
+ * direction selected by P2IES (0 - rising, 1 - falling).
+ */
+static void
+port2_edges(void)
+{
+    uint8_t pins = 0;
+    uint8_t changed;
+    int pad;
+
+    for (pad = 0; pad < NUM_PADS; pad++) {
+        pins |= pad_level(pad) << (pad + PAD_SHIFT);
+    }
+    changed = pins ^ pads_seen;
+    hal_host_regs.p2ifg |= changed & (pins ^ hal_host_regs.p2ies);
+    pads_seen = pins;
+}
+
+/* Cycles until the excitation next reaches a pad, or NO_EVENT. */
+static uint32_t
+pad_cycles_to_edge(void)
+{
+    uint32_t step = NO_EVENT;
+    unsigned int i;
+    int pad;
+
+    for (i = 0; i < EDGE_HISTORY; i++) {
+        for (pad = 0; pad < NUM_PADS; pad++) {
+            uint64_t arrival = edges[i].time + edges[i].delay[pad];
+            if (arrival > now && arrival - now < step) {
+                step = (uint32_t)(arrival - now);
+            }
+        }
+    }
+    return step;
+}
+
+static void
+parse_presses(void)
+{
+    const char *script = getenv("HOST_PRESS");
+    char *end;
+
+    while (script && *script && num_presses < MAX_PRESSES) {
+        presses[num_presses].ms = strtoul(script, &end, 0);
+        if (*end != ':') break;
+        presses[num_presses].mask = strtoul(end + 1, &end, 0);
+        num_presses++;
+        if (*end != ',') break;
+        script = end + 1;
+    }
+}
+
+
+/*********************************************************************
+ * WS2812 chains on the UCA0 and UCB0 MOSI lines
+ *********************************************************************/
+
+/* Records a bit received by the chain. The first 24 bits of a frame go
+ * to the first LED, the next 24 to the second and so on.
+ */
+static void
+chain_bit(struct host_chain *c, uint8_t bit)
+{
+    unsigned int byte = c->bits / 8;
+    if (byte < c->leds * 3) {
+        c->rx[byte] = (c->rx[byte] << 1) | bit;
+    }
+    c->bits++;
+}
+
+/* Decodes the MOSI waveform of one SPI byte: every high pulse longer
+ * than LONG_PULSE_CYCLES is a 1, every shorter one a 0. Also records the
+ * longest low between two pulses of a frame.
+ */
+static void
+chain_shift(struct host_chain *c, uint8_t byte, uint32_t bit_cycles)
+{
+    uint8_t mask;
+    for (mask = 0x80; mask; mask >>= 1) {
+        if (byte & mask) {
+            if (c->low_run > c->longest_low) c->longest_low = c->low_run;
+            c->low_run = 0;
+            c->high_run += bit_cycles;
+        } else if (c->high_run) {
+            chain_bit(c, c->high_run >= LONG_PULSE_CYCLES);
+            c->high_run = 0;
+            c->low_run = bit_cycles;
+        } else if (c->bits) {
+            c->low_run += bit_cycles;
+        }
+    }
+}
+
+/* Reset code: LEDs that received all 24 bits show their new color. The
+ * grid is logged once no chain is still receiving a frame.
+ */
+static void
+chain_latch(struct host_chain *c)
+{
+    unsigned int leds = c->bits / 24 < c->leds ? c->bits / 24 : c->leds;
+
+    memcpy(&chain[c->first * 3], c->rx, leds * 3);
+    c->bits = 0;
+    c->high_run = 0;
+    c->low_run = 0;
+    if (!usci_a0.frame_bytes && !usci_b0.frame_bytes) {
+        if (led_log) fwrite(chain, sizeof(chain), 1, led_log);
+        if (trace) {
+            fprintf(stderr, "host: %.3f ms LED frame %lu\n",
+                    (double)now / CYCLES_PER_MS, frames_shown++);
+        }
+        if (press_pending) {
+            uint64_t latency = now - press_time;
+
+            if (!latency_count || latency < latency_min) latency_min = latency;
+            if (latency > latency_max) latency_max = latency;
+            latency_sum += latency;
+            latency_count++;
+            press_pending = 0;
+        }
+    }
+}
+
+
+/*********************************************************************
+ * USCI SPI transmitter
+ *********************************************************************/
+
+/* Moves a buffered byte into the idle shift register. */
+static void
+usci_load(struct host_usci *u)
+{
+    if (u->shift_left || !u->buffer_full) return;
+
+    u->shift_left = 8 * (uint32_t)(*u->br0 | (*u->br1 << 8));
+    if (!u->shift_left) u->shift_left = 8;
+    u->buffer_full = 0;
+    if (!u->frame_bytes) {
+        u->frame_start = now;
+    } else if (u->chain->bits) {
+        u->chain->low_run += now - u->last_end;   // MOSI idled low.
+    }
+    if (spi_log && u == &usci_a0) fputc(u->buffered, spi_log);
+    chain_shift(u->chain, u->buffered, u->shift_left / 8);
+    u->bytes++;
+    u->frame_bytes++;
+    hal_host_regs.ifg2 |= u->txifg;
+}
+
+/* Latches a byte written to TXBUF since the last access. */
+static void
+usci_sync(struct host_usci *u)
+{
+    if (*u->ctl1 & UCSWRST) {
+        u->write_pending = 0;
+        u->buffer_full = 0;
+        u->shift_left = 0;
+        hal_host_regs.ifg2 |= u->txifg;
+        return;
+    }
+    if (!u->write_pending) return;
+
+    u->write_pending = 0;
+    u->buffered = *u->txbuf;
+    u->buffer_full = 1;
+    hal_host_regs.ifg2 &= ~u->txifg;
+    usci_load(u);
+}
+
+static void
+usci_run(struct host_usci *u, uint32_t cycles)
+{
+    if (!u->shift_left) return;
+    u->shift_left -= cycles;
+    if (!u->shift_left) {
+        u->last_end = now;
+        usci_load(u);
+    }
+}
+
+/* Cycles until MOSI has been low for the reset time after a frame. */
+static uint32_t
+usci_cycles_to_latch(const struct host_usci *u)
+{
+    if (!u->frame_bytes || u->shift_left || u->buffer_full) return NO_EVENT;
+    if (now - u->last_end >= RESET_CODE_CYCLES) return 0;
+    return (uint32_t)(u->last_end + RESET_CODE_CYCLES - now);
+}
+
+/* Ends the frame once MOSI stayed low for the reset time. */
+static void
+usci_latch(struct host_usci *u)
+{
+    if (usci_cycles_to_latch(u)) return;
+    u->frames++;
+    u->frame_cycles += u->last_end - u->frame_start;
+    u->frame_bytes = 0;
+    chain_latch(u->chain);
+}
+
+
+/*********************************************************************
+ * Timer_A
+ *********************************************************************/
+
+/* SMCLK cycles per TAR tick. Timer0 INCLK is the PinOsc of a pad. */
+static uint32_t
+timer_divider(const struct host_timer *t)
+{
+    uint32_t divider = 1UL << ((*t->ctl >> 6) & 0x3);
+    if ((*t->ctl & TASSEL_3) == TASSEL_3) {
+        divider *= t == &timers[0] ? pinosc_period() : 0;
+    }
+    return divider;
+}
+
+/* Up mode halts the timer while TACCR0 is zero. A timer without a clock
+ * does not run either.
+ */
+static int
+timer_running(const struct host_timer *t)
+{
+    uint16_t mode = *t->ctl & MC_3;
+    if (!timer_divider(t)) return 0;
+    return mode == MC_2 || (mode && t->ccr[0]);
+}
+
+/* Value TAR counts up to before wrapping to zero. */
+static uint16_t
+timer_top(const struct host_timer *t)
+{
+    if ((*t->ctl & MC_3) == MC_2) return 0xFFFF;
+    return t->ccr[0];
+}
+
+/* TAR ticks until TAR next wraps or reaches a compare value. */
+static uint32_t
+timer_ticks_to_event(const struct host_timer *t)
+{
+    uint16_t top = timer_top(t);
+    uint32_t ticks;
+    int n;
+
+    if (!timer_running(t)) return NO_EVENT;
+    if (*t->r >= top) return 1;
+
+    ticks = (uint32_t)top - *t->r + 1;
+    for (n = 0; n < 3; n++) {
+        if (t->cctl[n] & CAP) continue;
+        if (t->ccr[n] > *t->r && t->ccr[n] <= top && t->ccr[n] - *t->r < ticks) {
+            ticks = t->ccr[n] - *t->r;
+        }
+    }
+    return ticks;
+}
+
+static uint32_t
+timer_cycles_to_event(const struct host_timer *t)
+{
+    uint32_t ticks = timer_ticks_to_event(t);
+    if (ticks == NO_EVENT) return NO_EVENT;
+    ticks *= timer_divider(t);
+    return ticks > t->prescale ? ticks - t->prescale : 1;
+}
+
+/* Output unit of channel n on a TAR == TACCRn (ccr0 = 0) or a TAR ==
+ * TACCR0 (ccr0 = 1) event.
+ */
+static void
+timer_output(struct host_timer *t, int n, int ccr0)
+{
+    uint16_t mode = t->cctl[n] & OUTMOD_7;
+    uint8_t *out = &t->out[n];
+
+    if (!ccr0) {
+        if (mode == OUTMOD_1 || mode == OUTMOD_3) *out = 1;
+        if (mode == OUTMOD_5 || mode == OUTMOD_7) *out = 0;
+        if (mode == OUTMOD_2 || mode == OUTMOD_4 || mode == OUTMOD_6) *out ^= 1;
+    } else if (n) {
+        if (mode == OUTMOD_2 || mode == OUTMOD_3) *out = 0;
+        if (mode == OUTMOD_6 || mode == OUTMOD_7) *out = 1;
+    }
+}
+
+static void
+timer_flag(struct host_timer *t, int n)
+{
+    if ((t->cctl[n] & (CCIE | CCIFG)) == (CCIE | CCIFG)) t->lost++;
+    t->cctl[n] |= CCIFG;
+}
+
+/* Advances TAR by the ticks in "cycles", never past the next event. */
+static void
+timer_run(struct host_timer *t, uint32_t cycles)
+{
+    uint32_t ticks;
+    uint16_t top;
+    int n;
+
+    if (!timer_running(t)) return;
+
+    t->prescale += cycles;
+    ticks = t->prescale / timer_divider(t);
+    t->prescale %= timer_divider(t);
+    if (!ticks) return;
+
+    top = timer_top(t);
+    if (*t->r >= top || ticks > (uint32_t)top - *t->r) {
+        *t->r = 0;
+        *t->ctl |= TAIFG;
+    } else {
+        *t->r += ticks;
+    }
+
+    for (n = 0; n < 3; n++) {
+        if (!(t->cctl[n] & CAP) && t->ccr[n] == *t->r) {
+            timer_flag(t, n);
+            timer_output(t, n, 0);
+            if (!n) {
+                timer_output(t, 1, 1);
+                timer_output(t, 2, 1);
+            }
+        }
+    }
+}
+
+/* Captures TAR on a rising VLO edge (Timer0 CCR0, CCIS_1 = ACLK). */
+static void
+timer_capture_vlo(struct host_timer *t)
+{
+    uint16_t cctl = t->cctl[0];
+    if (!(cctl & CAP) || (cctl & CCIS_3) != CCIS_1 || !(cctl & CM_1)) return;
+    if (cctl & CCIFG) t->cctl[0] |= COV;
+    t->ccr[0] = *t->r;
+    t->cctl[0] |= CCIFG;
+}
+
+/* Reads TAxIV: the highest pending CCR1/CCR2/overflow source, cleared. */
+static uint16_t
+timer_vector(struct host_timer *t)
+{
+    int n;
+    for (n = 1; n < 3; n++) {
+        if ((t->cctl[n] & (CCIE | CCIFG)) == (CCIE | CCIFG)) {
+            t->cctl[n] &= ~CCIFG;
+            return 2 * n;
+        }
+    }
+    if ((*t->ctl & (TAIE | TAIFG)) == (TAIE | TAIFG)) {
+        *t->ctl &= ~TAIFG;
+        return 10;
+    }
+    return 0;
+}
+
+static int
+timer_ccr0_pending(const struct host_timer *t)
+{
+    return (t->cctl[0] & (CCIE | CCIFG)) == (CCIE | CCIFG);
+}
+
+static int
+timer_ccrn_pending(const struct host_timer *t)
+{
+    return (t->cctl[1] & (CCIE | CCIFG)) == (CCIE | CCIFG)
+        || (t->cctl[2] & (CCIE | CCIFG)) == (CCIE | CCIFG)
+        || (*t->ctl & (TAIE | TAIFG)) == (TAIE | TAIFG);
+}
+
+
+/*********************************************************************
+ * Interrupts and time
+ *********************************************************************/
+
+static void
+print_usci(const char *name, const struct host_usci *u)
+{
+    fprintf(stderr, "host: %s SPI bytes %lu, frames %lu, mean frame %.3f ms, "
+            "longest low inside a frame %.2f us\n", name, u->bytes, u->frames,
+            (double)u->frame_cycles / (u->frames ? u->frames : 1) / CYCLES_PER_MS,
+            (double)u->chain->longest_low / CYCLES_PER_US);
+}
+
+static void
+print_stats(void)
+{
+    int v;
+    fprintf(stderr, "host: simulated %.3f ms, %.1f%% in LPM0, "
+            "%.1f%% active with GIE clear, %lu wakeups\n",
+            (double)now / CYCLES_PER_MS,
+            100.0 * sleep_cycles / (now ? now : 1),
+            100.0 * masked_cycles / (now ? now : 1), wakeups);
+    for (v = 0; v < HOST_NUM_VECTORS; v++) {
+        if (vector_count[v]) {
+            fprintf(stderr, "host: %s interrupts %lu\n",
+                    vector_names[v], vector_count[v]);
+        }
+    }
+    fprintf(stderr, "host: TA0 lost compares %lu, TA1 lost compares %lu\n",
+            timers[0].lost, timers[1].lost);
+    print_usci("UCA0", &usci_a0);
+    if (latency_count) {
+        fprintf(stderr, "host: press to LED frame %.3f - %.3f ms, "
+                "mean %.3f ms over %lu presses\n",
+                (double)latency_min / CYCLES_PER_MS,
+                (double)latency_max / CYCLES_PER_MS,
+                (double)latency_sum / latency_count / CYCLES_PER_MS,
+                latency_count);
+    }
+    if (usci_b0.bytes) print_usci("UCB0", &usci_b0);
+}
+
+/* Highest priority vector with a pending, enabled source, or -1. */
+static int
+pending_vector(void)
+{
+    if (timer_ccr0_pending(&timers[1])) return TIMER1_A0_VECTOR;
+    if (timer_ccrn_pending(&timers[1])) return TIMER1_A1_VECTOR;
+    if (timer_ccr0_pending(&timers[0])) return TIMER0_A0_VECTOR;
+    if (timer_ccrn_pending(&timers[0])) return TIMER0_A1_VECTOR;
+    if (hal_host_regs.ie2 & hal_host_regs.ifg2 & (UCA0TXIE | UCB0TXIE)) {
+        return USCIAB0TX_VECTOR;
+    }
+    if (hal_host_regs.p2ie & hal_host_regs.p2ifg) return PORT2_VECTOR;
+    return -1;
+}
+
+/* Brings pending register writes and pin levels up to date. */
+static void
+sync(void)
+{
+    int n, c;
+    for (n = 0; n < 2; n++) {
+        for (c = 0; c < 3; c++) {
+            if (!(timers[n].cctl[c] & OUTMOD_7)) {
+                timers[n].out[c] = (timers[n].cctl[c] & OUT) != 0;
+            }
+        }
+        if (*timers[n].ctl & TACLR) {
+            *timers[n].ctl &= ~TACLR;
+            *timers[n].r = 0;
+            timers[n].prescale = 0;
+        }
+    }
+    usci_sync(&usci_a0);
+    usci_sync(&usci_b0);
+    if (excitation_level() != excitation) {
+        record_edge(excitation_level());
+    }
+    port2_edges();
+}
+
+/* Runs interrupt service routines while GIE is set and one is pending. */
+static void
+dispatch(void)
+{
+    int vector;
+    while ((sr & GIE) && (vector = pending_vector()) >= 0) {
+        uint16_t stacked = sr;
+        uint16_t *outer = exit_sr;
+
+        if (!vectors[vector]) fatal("interrupt without a service routine");
+        if (vector == TIMER1_A0_VECTOR) timers[1].cctl[0] &= ~CCIFG;
+        if (vector == TIMER0_A0_VECTOR) timers[0].cctl[0] &= ~CCIFG;
+
+        if (sr & CPUOFF) wakeups++;
+        sr &= SCG0;
+        exit_sr = &stacked;
+        vector_count[vector]++;
+        hal_host_advance(ISR_ENTRY_CYCLES + isr_cycles);
+        vectors[vector]();
+        exit_sr = outer;
+        sr = stacked;
+        sync();
+
+        if (hal_host_regs.p3out != p3out_seen) {
+            if (hal_host_regs.p3out & ~p3out_seen) {
+                press_pending = 1;
+                press_time = now;
+            } else if (!hal_host_regs.p3out) {
+                press_pending = 0;
+            }
+            p3out_seen = hal_host_regs.p3out;
+            if (trace) {
+                fprintf(stderr, "host: %.3f ms P3OUT 0x%02x\n",
+                        (double)now / CYCLES_PER_MS, p3out_seen);
+            }
+        }
+    }
+}
+
+/* Cycles until the next peripheral event, at most "limit". */
+static uint32_t
+next_event(uint64_t limit)
+{
+    uint32_t step = limit > NO_EVENT ? NO_EVENT : (uint32_t)limit;
+    uint32_t cycles;
+    int n;
+
+    for (n = 0; n < 2; n++) {
+        cycles = timer_cycles_to_event(&timers[n]);
+        if (cycles < step) step = cycles;
+    }
+    if (usci_a0.shift_left && usci_a0.shift_left < step) {
+        step = usci_a0.shift_left;
+    }
+    if (usci_b0.shift_left && usci_b0.shift_left < step) {
+        step = usci_b0.shift_left;
+    }
+    cycles = usci_cycles_to_latch(&usci_a0);
+    if (cycles < step) step = cycles;
+    cycles = usci_cycles_to_latch(&usci_b0);
+    if (cycles < step) step = cycles;
+    if (hal_host_regs.p2ie) {
+        cycles = pad_cycles_to_edge();
+        if (cycles < step) step = cycles;
+    }
+    if (next_vlo - now < step) step = (uint32_t)(next_vlo - now);
+    if (end_time - now < step) step = (uint32_t)(end_time - now);
+    return step ? step : 1;
+}
+
+static void
+hal_host_advance(uint64_t cycles)
+{
+    while (cycles) {
+        uint32_t step = next_event(cycles);
+        int n;
+
+        now += step;
+        cycles -= step;
+        if (sr & CPUOFF) {
+            sleep_cycles += step;
+        } else if (!(sr & GIE)) {
+            masked_cycles += step;
+        }
+
+        for (n = 0; n < 2; n++) {
+            timer_run(&timers[n], step);
+        }
+        usci_run(&usci_a0, step);
+        usci_run(&usci_b0, step);
+        usci_latch(&usci_a0);
+        usci_latch(&usci_b0);
+        if (now >= next_vlo) {
+            timer_capture_vlo(&timers[0]);
+            next_vlo = now + VLO_PERIOD - VLO_JITTER / 2
+                + host_rand() % VLO_JITTER;
+        }
+        if (now >= end_time) {
+            print_stats();
+            exit(0);
+        }
+
+        sync();
+        dispatch();
+    }
+}
+
+/* Sleeps until an interrupt clears CPUOFF on exit. */
+static void
+sleep_lpm0(void)
+{
+    while (sr & CPUOFF) {
+        if (!(sr & GIE)) fatal("LPM entered with interrupts disabled");
+        hal_host_advance(next_event(end_time - now));
+    }
+}
+
+void *
+hal_host_access(void *reg)
+{
+    hal_host_advance(1);
+    if (reg == &hal_host_regs.p2in) {
+        hal_host_regs.p2in = port2_input();
+    } else if (reg == &hal_host_regs.ta0iv) {
+        hal_host_regs.ta0iv = timer_vector(&timers[0]);
+    } else if (reg == &hal_host_regs.ta1iv) {
+        hal_host_regs.ta1iv = timer_vector(&timers[1]);
+    } else if (reg == usci_a0.txbuf) {
+        usci_a0.write_pending = 1;
+    } else if (reg == usci_b0.txbuf) {
+        usci_b0.write_pending = 1;
+    }
+    return reg;
+}
+
+void
+hal_host_set_vector(int vector, void (*isr)(void))
+{
+    vectors[vector] = isr;
+}
+
+void
+__bis_SR_register(uint16_t bits)
+{
+    sync();
+    sr |= bits;
+    dispatch();
+    sleep_lpm0();
+}
+
+void
+__bic_SR_register(uint16_t bits)
+{
+    sr &= ~bits;
+}
+
+void
+__bis_SR_register_on_exit(uint16_t bits)
+{
+    if (exit_sr) *exit_sr |= bits;
+}
+
+void
+__bic_SR_register_on_exit(uint16_t bits)
+{
+    if (exit_sr) *exit_sr &= ~bits;
+}
+
+void
+__delay_cycles(unsigned long cycles)
+{
+    hal_host_advance(cycles);
+}
+
+/* Power-on reset: load the configuration and reset peripheral state. */
+static void __attribute__((constructor))
+hal_host_reset(void)
+{
+    rng_state = env_number("HOST_SEED", 1);
+    if (!rng_state) rng_state = 1;
+    end_time = env_number("HOST_SIM_MS", 20000) * CYCLES_PER_MS;
+    pad_delay = env_number("HOST_PAD_DELAY_US", 2) * CYCLES_PER_US;
+    touch_delay = env_number("HOST_TOUCH_DELAY_US", 2500) * CYCLES_PER_US;
+    pad_noise = env_number("HOST_PAD_NOISE_US", 0) * CYCLES_PER_US;
+    pinosc_cycles = env_number("HOST_PINOSC_CYCLES", 16);
+    pinosc_touch_cycles = env_number("HOST_PINOSC_TOUCH_CYCLES", 17);
+    isr_cycles = env_number("HOST_ISR_CYCLES", ISR_CYCLES);
+    trace = env_number("HOST_TRACE", 0);
+    if (getenv("HOST_SPI_LOG")) spi_log = fopen(getenv("HOST_SPI_LOG"), "wb");
+    if (getenv("HOST_LED_LOG")) led_log = fopen(getenv("HOST_LED_LOG"), "wb");
+    parse_presses();
+
+    hal_host_regs.ifg2 = UCA0TXIFG | UCB0TXIFG;
+    hal_host_regs.uca0ctl1 = UCSWRST;
+    hal_host_regs.ucb0ctl1 = UCSWRST;
+    next_vlo = VLO_PERIOD;
+}
+
+#endif /* HOST_BUILD */
@@ -0,0 +1,299 @@
+/*************************************************************************
+ * Host backend of the hardware abstraction layer (-DHOST_BUILD).
+ *
+ * Provides the MSP430G2553 register names, bit definitions and
+ * intrinsics used by the firmware, backed by a cycle counted simulation
+ * of the peripherals in hal_host.c:
+ *
+ *  - Ports 1 - 3. The capacitive pads on P2.2 - P2.6 follow the P2.1
+ *    excitation after a per-pad delay which grows while a pad is touched.
+ *    Pad edges set P2IFG as selected by P2IES and interrupt through P2IE.
+ *    A pad selected with P2SEL2 runs its PinOsc oscillator, which clocks
+ *    Timer0_A through INCLK (TASSEL_3) and slows down while touched.
+ *  - USCI_A0 in SPI master mode (UCA0TXBUF, UCA0TXIFG, UCA0TXIE), driving
+ *    a WS2812 chain that decodes the MOSI pulse widths. USCI_B0 drives a
+ *    second chain holding the second 8x8 panel (LEDs 64 - 127) when the
+ *    panels are wired to separate channels.
+ *  - Timer0_A3 and Timer1_A3 in up and continuous mode, including the
+ *    ACLK (VLO) capture used by generate_seed() and the output units.
+ *    TA1.1 drives the pad excitation on P2.1 while P2SEL.1 is set.
+ *  - The GIE and LPM0 bits of the status register, interrupt dispatch by
+ *    priority and LPM0 wakeup through __bic_SR_register_on_exit().
+ *
+ * Simulated time is counted in SMCLK (16 MHz) cycles. Every register
+ * access costs one cycle so polling loops make progress; plain C code is
+ * free, except that every interrupt is charged HOST_ISR_CYCLES for its
+ * register saves, body and return. The run is configured from the
+ * environment:
+ *
+ *  HOST_SIM_MS          Simulated run length in ms (default 20000).
+ *  HOST_SEED            Seed for the VLO jitter and pad noise (default 1).
+ *  HOST_PRESS           Touch script "ms:mask,ms:mask,..."; from each time
+ *                       on the pads in mask (bit 0 - Up ... bit 4 - Middle)
+ *                       are touched.
+ *  HOST_PAD_DELAY_US    Pad delay while untouched (default 2).
+ *  HOST_TOUCH_DELAY_US  Pad delay while touched (default 2500).
+ *  HOST_PAD_NOISE_US    Uniform jitter added to every pad edge (default 0).
+ *  HOST_PINOSC_CYCLES   PinOsc period of an untouched pad in SMCLK cycles
+ *                       (default 16, i.e. 1 MHz).
+ *  HOST_PINOSC_TOUCH_CYCLES
+ *                       PinOsc period of a touched pad (default 17).
+ *  HOST_ISR_CYCLES      Cycles charged to every interrupt on top of its
+ *                       6 cycle entry (default 60, a short C routine).
+ *  HOST_TRACE           When non-zero, log every change of the pad LEDs on
+ *                       P3OUT, i.e. the detected button state, and every
+ *                       grid frame shown, numbered as in HOST_LED_LOG.
+ *  HOST_SPI_LOG         File that receives every byte shifted out by UCA0.
+ *  HOST_LED_LOG         File that receives the GRB colors of the 128 LEDs
+ *                       each time a frame is latched on every chain.
+ *
+ * When the run ends the peripheral statistics are printed to stderr and
+ * the process exits, so the firmware's main() never has to return. They
+ * include the mean time of a frame on each chain, the longest low on its
+ * MOSI between two bits of a frame, and the latency from each press
+ * lighting a pad LED on P3OUT to the next grid frame latched while it is
+ * held.
+ ************************************************************************/
+
+#ifndef hal_host_h
+#define hal_host_h
+
+#include <stdint.h>
+
+/* Peripheral register file. Accessed only through the register macros. */
+struct hal_host_regs {
+    uint16_t wdtctl;
+    uint8_t dcoctl, bcsctl1, bcsctl2, bcsctl3;
+    uint8_t ie2, ifg2;
+
+    uint8_t p1in, p1out, p1dir, p1sel, p1sel2, p1ren;
+    uint8_t p2in, p2out, p2dir, p2sel, p2sel2, p2ren;
+    uint8_t p2ie, p2ies, p2ifg;
+    uint8_t p3in, p3out, p3dir, p3sel, p3sel2, p3ren;
+
+    uint8_t uca0ctl0, uca0ctl1, uca0br0, uca0br1, uca0mctl, uca0stat;
+    uint8_t uca0rxbuf, uca0txbuf;
+    uint8_t ucb0ctl0, ucb0ctl1, ucb0br0, ucb0br1, ucb0stat;
+    uint8_t ucb0rxbuf, ucb0txbuf;
+
+    uint16_t ta0ctl, ta0r, ta0cctl[3], ta0ccr[3], ta0iv;
+    uint16_t ta1ctl, ta1r, ta1cctl[3], ta1ccr[3], ta1iv;
+};
+
+extern struct hal_host_regs hal_host_regs;
+
+/* Charges one cycle, brings the peripherals up to date and returns reg. */
+void *hal_host_access(void *reg);
+
+#define HOST_REG(r) \
+    (*(__typeof__(hal_host_regs.r) *)hal_host_access(&hal_host_regs.r))
+
+/* Registers */
+#define WDTCTL      HOST_REG(wdtctl)
+#define DCOCTL      HOST_REG(dcoctl)
+#define BCSCTL1     HOST_REG(bcsctl1)
+#define BCSCTL2     HOST_REG(bcsctl2)
+#define BCSCTL3     HOST_REG(bcsctl3)
+#define IE2         HOST_REG(ie2)
+#define IFG2        HOST_REG(ifg2)
+
+#define P1IN        HOST_REG(p1in)
+#define P1OUT       HOST_REG(p1out)
+#define P1DIR       HOST_REG(p1dir)
+#define P1SEL       HOST_REG(p1sel)
+#define P1SEL2      HOST_REG(p1sel2)
+#define P1REN       HOST_REG(p1ren)
+#define P2IN        HOST_REG(p2in)
+#define P2OUT       HOST_REG(p2out)
+#define P2DIR       HOST_REG(p2dir)
+#define P2SEL       HOST_REG(p2sel)
+#define P2SEL2      HOST_REG(p2sel2)
+#define P2REN       HOST_REG(p2ren)
+#define P2IE        HOST_REG(p2ie)
+#define P2IES       HOST_REG(p2ies)
+#define P2IFG       HOST_REG(p2ifg)
+#define P3IN        HOST_REG(p3in)
+#define P3OUT       HOST_REG(p3out)
+#define P3DIR       HOST_REG(p3dir)
+#define P3SEL       HOST_REG(p3sel)
+#define P3SEL2      HOST_REG(p3sel2)
+#define P3REN       HOST_REG(p3ren)
+
+#define UCA0CTL0    HOST_REG(uca0ctl0)
+#define UCA0CTL1    HOST_REG(uca0ctl1)
+#define UCA0BR0     HOST_REG(uca0br0)
+#define UCA0BR1     HOST_REG(uca0br1)
+#define UCA0MCTL    HOST_REG(uca0mctl)
+#define UCA0STAT    HOST_REG(uca0stat)
+#define UCA0RXBUF   HOST_REG(uca0rxbuf)
+#define UCA0TXBUF   HOST_REG(uca0txbuf)
+#define UCB0CTL0    HOST_REG(ucb0ctl0)
+#define UCB0CTL1    HOST_REG(ucb0ctl1)
+#define UCB0BR0     HOST_REG(ucb0br0)
+#define UCB0BR1     HOST_REG(ucb0br1)
+#define UCB0STAT    HOST_REG(ucb0stat)
+#define UCB0RXBUF   HOST_REG(ucb0rxbuf)
+#define UCB0TXBUF   HOST_REG(ucb0txbuf)
+
+#define TA0CTL      HOST_REG(ta0ctl)
+#define TA0R        HOST_REG(ta0r)
+#define TA0CCTL0    HOST_REG(ta0cctl[0])
+#define TA0CCTL1    HOST_REG(ta0cctl[1])
+#define TA0CCTL2    HOST_REG(ta0cctl[2])
+#define TA0CCR0     HOST_REG(ta0ccr[0])
+#define TA0CCR1     HOST_REG(ta0ccr[1])
+#define TA0CCR2     HOST_REG(ta0ccr[2])
+#define TA0IV       HOST_REG(ta0iv)
+#define TA1CTL      HOST_REG(ta1ctl)
+#define TA1R        HOST_REG(ta1r)
+#define TA1CCTL0    HOST_REG(ta1cctl[0])
+#define TA1CCTL1    HOST_REG(ta1cctl[1])
+#define TA1CCTL2    HOST_REG(ta1cctl[2])
+#define TA1CCR0     HOST_REG(ta1ccr[0])
+#define TA1CCR1     HOST_REG(ta1ccr[1])
+#define TA1CCR2     HOST_REG(ta1ccr[2])
+#define TA1IV       HOST_REG(ta1iv)
+
+/* Timer0_A3 aliases used by older code. */
+#define TACTL       TA0CTL
+#define TAR         TA0R
+#define TACCTL0     TA0CCTL0
+#define TACCTL1     TA0CCTL1
+#define TACCTL2     TA0CCTL2
+#define TACCR0      TA0CCR0
+#define TACCR1      TA0CCR1
+#define TACCR2      TA0CCR2
+
+/* Factory calibration constants (information memory on the target). */
+#define CALDCO_16MHZ  0x95
+#define CALBC1_16MHZ  0x8F
+
+/* Bits */
+#define BIT0        0x0001
+#define BIT1        0x0002
+#define BIT2        0x0004
+#define BIT3        0x0008
+#define BIT4        0x0010
+#define BIT5        0x0020
+#define BIT6        0x0040
+#define BIT7        0x0080
+
+/* Status register */
+#define GIE         0x0008
+#define CPUOFF      0x0010
+#define OSCOFF      0x0020
+#define SCG0        0x0040
+#define SCG1        0x0080
+#define LPM0_bits   (CPUOFF)
+
+/* Watchdog */
+#define WDTPW       0x5A00
+#define WDTHOLD     0x0080
+
+/* Basic clock */
+#define LFXT1S_0    0x00
+#define LFXT1S_2    0x20
+#define LFXT1S_3    0x30
+
+/* Timer_A control */
+#define TAIFG       0x0001
+#define TAIE        0x0002
+#define TACLR       0x0004
+#define MC_0        0x0000
+#define MC_1        0x0010
+#define MC_2        0x0020
+#define MC_3        0x0030
+#define ID_0        0x0000
+#define ID_1        0x0040
+#define ID_2        0x0080
+#define ID_3        0x00C0
+#define TASSEL_1    0x0100
+#define TASSEL_2    0x0200
+#define TASSEL_3    0x0300
+
+/* Timer_A interrupt vector values */
+#define TA0IV_NONE      0x0000
+#define TA0IV_TACCR1    0x0002
+#define TA0IV_TACCR2    0x0004
+#define TA0IV_TAIFG     0x000A
+#define TA1IV_NONE      0x0000
+#define TA1IV_TACCR1    0x0002
+#define TA1IV_TACCR2    0x0004
+#define TA1IV_TAIFG     0x000A
+
+/* Timer_A capture/compare control */
+#define CCIFG       0x0001
+#define COV         0x0002
+#define OUT         0x0004
+#define CCI         0x0008
+#define CCIE        0x0010
+#define OUTMOD_0    0x0000
+#define OUTMOD_1    0x0020
+#define OUTMOD_2    0x0040
+#define OUTMOD_3    0x0060
+#define OUTMOD_4    0x0080
+#define OUTMOD_5    0x00A0
+#define OUTMOD_6    0x00C0
+#define OUTMOD_7    0x00E0
+#define CAP         0x0100
+#define SCS         0x0800
+#define CCIS_0      0x0000
+#define CCIS_1      0x1000
+#define CCIS_2      0x2000
+#define CCIS_3      0x3000
+#define CM_0        0x0000
+#define CM_1        0x4000
+#define CM_2        0x8000
+#define CM_3        0xC000
+
+/* USCI */
+#define UCSYNC      0x01
+#define UCMST       0x08
+#define UCMSB       0x20
+#define UCCKPL      0x40
+#define UCCKPH      0x80
+#define UCSWRST     0x01
+#define UCSSEL_2    0x80
+#define UCA0RXIFG   0x01
+#define UCA0TXIFG   0x02
+#define UCA0RXIE    0x01
+#define UCA0TXIE    0x02
+#define UCB0RXIFG   0x04
+#define UCB0TXIFG   0x08
+#define UCB0RXIE    0x04
+#define UCB0TXIE    0x08
+
+/* Interrupt vectors, numbered by priority as on the G2553. */
+#define PORT1_VECTOR        2
+#define PORT2_VECTOR        3
+#define ADC10_VECTOR        5
+#define USCIAB0TX_VECTOR    6
+#define USCIAB0RX_VECTOR    7
+#define TIMER0_A1_VECTOR    8
+#define TIMER0_A0_VECTOR    9
+#define WDT_VECTOR          10
+#define COMPARATORA_VECTOR  11
+#define TIMER1_A1_VECTOR    12
+#define TIMER1_A0_VECTOR    13
+#define NMI_VECTOR          14
+#define HOST_NUM_VECTORS    16
+
+/* Intrinsics */
+void __bis_SR_register(uint16_t bits);
+void __bic_SR_register(uint16_t bits);
+void __bis_SR_register_on_exit(uint16_t bits);
+void __bic_SR_register_on_exit(uint16_t bits);
+void __delay_cycles(unsigned long cycles);
+
+/* Interrupt service routines register themselves before main() runs. */
+void hal_host_set_vector(int vector, void (*isr)(void));
+
+#define HOST_ISR(vector, name)                                          \
+    void name(void);                                                    \
+    static void __attribute__((constructor)) name##_register(void)      \
+    {                                                                   \
+        hal_host_set_vector(vector, name);                              \
+    }                                                                   \
+    void name(void)
+
+#endif /* hal_host_h */
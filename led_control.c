@@ -1,5 +1,6 @@
-#include <msp430.h>
+#include "hal.h"
 #include <stdint.h>
+#include <string.h>
 
 #include "led_control.h"
 
@@ -11,103 +12,287 @@
 #define NUM_LEDS 128
 #define COLUMNS 8
 #define ROWS 16
+#define BOARD_BYTES (NUM_LEDS / LEDS_PER_BYTE)
 
-// LED colors
-#define OFF           0
-#define RED           1
-#define GREEN         2
-#define BLUE          3
-#define RED_FADE_1    4
-#define RED_FADE_2    5
-#define RED_FADE_3    6
-#define BLUE_FADE_1   7
-#define BLUE_FADE_2   8
-#define BLUE_FADE_3   9
-#define GREEN_FADE_1  10
-#define GREEN_FADE_2  11
-#define GREEN_FADE_3  12
-#define YELLOW        13
-#define PURPLE        14
+#if SPI_CHANNELS != 1 && SPI_CHANNELS != 2
+#error SPI_CHANNELS must be 1 or 2
+#endif
 
-#define BRIGHTNESS    3
+// LEDs in the chain of each SPI channel.
+#define CHANNEL_LEDS (NUM_LEDS / SPI_CHANNELS)
 
+// Fades in progress at once.
+#define MAX_FADES 8
 
-// WS2812 LEDs require GRB format
-typedef struct {
-    unsigned char green;
-    unsigned char red;
-    unsigned char blue;
-} LED;
+// TA1 ticks from queuing the last code until the frame is latched: two
+// codes still shifting (8 bits * UCA0BR0 each) plus the 50us reset time.
+#define LATCH_TIME    (2 * 8 * SPI_DIVIDER + 800)
 
-LED expanded_color = {0, 0, 0};         // Single object colors are expaded into.
+/* Front and back frame buffers. The front board is the last one committed
+ * and is read by the transmit interrupt; the back board is drawn into.
+ */
+static uint8_t boards[2][BOARD_BYTES];
+static uint8_t *front = boards[0];
+static uint8_t *back = boards[1];
+
+/* Transmit state of the chain on one SPI channel. */
+struct tx_channel {
+    const uint8_t *pairs;               // Board bytes of the chain.
+    pixel_source source;                // Generator of a streamed frame, or 0.
+    unsigned int first;                 // LED index of the start of the chain.
+    unsigned int end;                   // LEDs of the chain sent in this frame.
+    uint8_t pair;                       // Byte holding the current LED pair.
+    const LED *shade;                   // Color of the LED sent next.
+};
+
+/* Frame transmission state shared with the USCI TX and TA1 CCR2 interrupts. */
+static const uint8_t *tx_board;         // Board being transmitted.
+static unsigned int tx_led = 0;         // LED of every chain sent next.
+static unsigned int tx_end;             // LEDs sent on the first, longest chain.
+static struct tx_channel tx_channels[SPI_CHANNELS];
+
+/* One past the last LED of each chain changed since the last frame was
+ * started, or 0 if the chain is unchanged. Everything is sent after
+ * power up.
+ */
+static unsigned int dirty_end[SPI_CHANNELS] = {
+    CHANNEL_LEDS,
+#if SPI_CHANNELS == 2
+    CHANNEL_LEDS,
+#endif
+};
+static volatile uint8_t frame_busy = 0;
+static volatile unsigned int frame_edges = 0;  // Starts plus latches.
+static volatile uint8_t refresh_waiting = 0;
+
+/* Gamma corrected (2.2) scale of every brightness level, out of 256.
+ * Stored in flash.
+ */
+static const uint8_t brightness_scale[MAX_BRIGHTNESS + 1] = {
+    0, 1, 3, 7, 14, 23, 34, 48, 64, 83, 105, 129, 156, 186, 219, 255
+};
+
+/* Full scale GRB value of every color. Used until load_palette() is
+ * called with a different palette.
+ */
+static const LED default_palette[PALETTE_SIZE] = {
+    [OFF]          = {0x00, 0x00, 0x00},
+    [RED]          = {0x00, 0xFF, 0x00},
+    [GREEN]        = {0xFF, 0x00, 0x00},
+    [BLUE]         = {0x00, 0x00, 0xFF},
+    [YELLOW]       = {0x80, 0xFF, 0x00},
+    [PURPLE]       = {0x00, 0xFF, 0xFF},
+};
+
+static const LED *palette = default_palette;
+static uint8_t brightness = DEFAULT_BRIGHTNESS;
+
+/* GRB value of every color at the current brightness. Every 4 bit color
+ * has an entry, so looking up a LED is a plain index. Recomputed by the
+ * next frame after the palette or brightness changes.
+ */
+static LED shade[PALETTE_SIZE];
+static uint8_t shade_stale = 1;
+
+/* A LED fading between two colors. The board already holds the end
+ * color; the transmit interrupt sends "now" instead while the fade runs.
+ */
+struct fade {
+    uint8_t led;
+    uint8_t from;                       // Start color.
+    uint8_t to;                         // End color.
+    uint16_t level;                     // Progress, 0 to 0xFFFF at "to".
+    uint16_t step;                      // Progress per frame.
+    LED now;                            // Blended shade of this frame.
+};
+
+static struct fade fades[MAX_FADES];
+static uint8_t num_fades = 0;
+static uint8_t fading[NUM_LEDS / 8];    // Bit of every LED in fades.
+
+
+/* Extends the dirty prefix of the chain holding led to cover it. */
+static void
+mark_dirty(unsigned int led)
+{
+    unsigned int channel = led / CHANNEL_LEDS;
+    unsigned int offset = led % CHANNEL_LEDS;
+    
+    if (offset >= dirty_end[channel]) {
+        dirty_end[channel] = offset + 1;
+    }
+}
+
+/* Marks every LED to be sent by the next frame. */
+static void
+mark_all_dirty()
+{
+    unsigned int channel;
+    for (channel = 0; channel < SPI_CHANNELS; channel++) {
+        dirty_end[channel] = CHANNEL_LEDS;
+    }
+}
 
+/* Returns 1 if any LED changed since the last frame was started. */
+static unsigned int
+board_dirty()
+{
+    unsigned int channel;
+    for (channel = 0; channel < SPI_CHANNELS; channel++) {
+        if (dirty_end[channel]) return 1;
+    }
+    return 0;
+}
 
-/* Sets the color of the led at index led in led_board
- * encoded into one byte.
+/* Sets the color of the led at index led in led_board.
+ *
+ * led_board packs two LEDs into each byte: even LEDs in the low nibble
+ * and odd LEDs in the high nibble.
  */
 void
 set_color(unsigned int led, uint8_t color, uint8_t *led_board)
 {
-    led_board[led] = color;
+    uint8_t *pair = &led_board[led >> 1];
+    uint8_t old_pair = *pair;
+    
+    if (led & 1) {
+        *pair = (*pair & 0x0F) | (color << 4);
+    } else {
+        *pair = (*pair & 0xF0) | (color & 0x0F);
+    }
+    
+    if (*pair != old_pair) {
+        mark_dirty(led);
+    }
 }
 
-/* Expands the encoded color at index led in led_board to 8 bit hexadecimal
- * for SPI transmission.
+/* Returns the color of the led at index led in led_board. */
+uint8_t
+get_color(unsigned int led, const uint8_t *led_board)
+{
+    uint8_t pair = led_board[led >> 1];
+    
+    return (led & 1) ? (pair >> 4) : (pair & 0x0F);
+}
+
+/* Replaces the palette with colors, an array of PALETTE_SIZE full scale
+ * GRB values indexed by color. 0 restores the default palette. colors
+ * must stay valid while it is in use. The whole board is sent with the
+ * new colors by the next refresh.
  */
 void
-expand_color(unsigned int led, uint8_t *led_board)
-{
-    expanded_color.red = 0x00;
-    expanded_color.green = 0x00;
-    expanded_color.blue = 0x00;
-    
-    switch (led_board[led]) {
-        case RED:
-            expanded_color.red = (0x08 * BRIGHTNESS);
-            break;
-        case GREEN:
-            expanded_color.green = (0x08 * BRIGHTNESS);
-            break;
-        case BLUE:
-            expanded_color.blue = (0x08 * BRIGHTNESS);
-            break;
-        case RED_FADE_1:
-            expanded_color.red = (0x04 * BRIGHTNESS);
-            break;
-        case RED_FADE_2:
-            expanded_color.red = (0x02 * BRIGHTNESS);
-            break;
-        case RED_FADE_3:
-            expanded_color.red = (0x01 * BRIGHTNESS);
-            break;
-        case BLUE_FADE_1:
-            expanded_color.blue = (0x04 * BRIGHTNESS);
-            break;
-        case BLUE_FADE_2:
-            expanded_color.blue = (0x02 * BRIGHTNESS);
-            break;
-        case BLUE_FADE_3:
-            expanded_color.blue = (0x01 * BRIGHTNESS);
-            break;
-        case GREEN_FADE_1:
-            expanded_color.green = (0x04 * BRIGHTNESS);
-            break;
-        case GREEN_FADE_2:
-            expanded_color.green = (0x02 * BRIGHTNESS);
-            break;
-        case GREEN_FADE_3:
-            expanded_color.green = (0x01 * BRIGHTNESS);
-            break;
-        case YELLOW:
-            expanded_color.red = (0x12 * BRIGHTNESS);
-            expanded_color.green = (0x09 * BRIGHTNESS);
-            break;
-        case PURPLE:
-            expanded_color.red = (0x08 * BRIGHTNESS);
-            expanded_color.blue = (0x08 * BRIGHTNESS);
-            break;
-        default:
-            break;
+load_palette(const LED *colors)
+{
+    palette = colors ? colors : default_palette;
+    shade_stale = 1;
+    mark_all_dirty();
+}
+
+/* Sets the global brightness level, 0 (off) to MAX_BRIGHTNESS. The whole
+ * board is sent at the new level by the next refresh.
+ */
+void
+set_brightness(uint8_t level)
+{
+    if (level > MAX_BRIGHTNESS) level = MAX_BRIGHTNESS;
+    brightness = level;
+    shade_stale = 1;
+    mark_all_dirty();
+}
+
+/* Returns the global brightness level. */
+uint8_t
+get_brightness()
+{
+    return brightness;
+}
+
+
+static void update_shade();
+
+/* Sets the color of the led at index led in led_board to "to", shown
+ * fading there from color "from" over the next "frames" frames. A frame
+ * is a refresh_board() or commit_board() call, each of which moves the
+ * fades on, so a fade lasts "frames" refresh periods of the caller. The
+ * colors are blended in 8 bit fixed point at the current brightness, so
+ * fades need no palette entries. Returns 0 if MAX_FADES fades are already
+ * running, in which case the LED changes at once.
+ */
+unsigned int
+fade_color(unsigned int led, uint8_t from, uint8_t to, unsigned int frames,
+           uint8_t *led_board)
+{
+    struct fade *fade = fades;
+    
+    set_color(led, to, led_board);
+    if (!frames) return 1;
+    
+    // The transmit interrupt reads the fades of the frame on the wire.
+    refresh_wait();
+    if (shade_stale) update_shade();
+    
+    while (fade < fades + num_fades && fade->led != led) fade++;
+    if (fade == fades + num_fades) {
+        if (num_fades == MAX_FADES) return 0;
+        num_fades++;
+    }
+    fade->led = led;
+    fade->from = from;
+    fade->to = to;
+    fade->level = 0;
+    fade->step = frames < 0xFFFF ? 0xFFFF / frames : 1;
+    fade->now = shade[from];
+    fading[led >> 3] |= 1 << (led & 7);
+    mark_dirty(led);
+    return 1;
+}
+
+/* Returns the number of fades still running. */
+unsigned int
+fades_active()
+{
+    return num_fades;
+}
+
+/* Returns channel * (256 - weight) + to * weight, over 256. */
+static inline uint8_t
+blend(uint8_t channel, uint8_t to, unsigned int weight)
+{
+    return ((unsigned int)channel * (256 - weight)
+            + (unsigned int)to * weight) >> 8;
+}
+
+/* Moves every fade a frame on and marks its LED to be sent. Fades that
+ * reached their end are dropped, so that frame shows the board color.
+ * Only called between frames, while the transmit interrupt is not reading
+ * the fades.
+ */
+static void
+advance_fades()
+{
+    unsigned int i = 0;
+    
+    if (shade_stale) update_shade();
+    
+    while (i < num_fades) {
+        struct fade *fade = &fades[i];
+        const LED *from = &shade[fade->from];
+        const LED *to = &shade[fade->to];
+        unsigned int weight = fade->level >> 8;
+        
+        mark_dirty(fade->led);
+        if (fade->level == 0xFFFF) {
+            fading[fade->led >> 3] &= ~(1 << (fade->led & 7));
+            *fade = fades[--num_fades];
+            continue;
+        }
+        
+        fade->now.green = blend(from->green, to->green, weight);
+        fade->now.red = blend(from->red, to->red, weight);
+        fade->now.blue = blend(from->blue, to->blue, weight);
+        fade->level = (fade->level > 0xFFFF - fade->step)
+                    ? 0xFFFF : fade->level + fade->step;
+        i++;
     }
 }
 
@@ -121,65 +306,379 @@ void clear_strip(uint8_t *led_board) {
  * Transmits the updated board state.
  */
 void fill_strip(uint8_t color, uint8_t *led_board) {
-    int i;
-    for (i = 0; i < NUM_LEDS; i++) {
-        set_color(i, color, led_board);
+    uint8_t pair = (color << 4) | (color & 0x0F);
+    unsigned int i;
+    for (i = 0; i < NUM_LEDS / LEDS_PER_BYTE; i++) {
+        if (led_board[i] != pair) {
+            led_board[i] = pair;
+            mark_dirty(LEDS_PER_BYTE * (i + 1) - 1);
+        }
     }
     refresh_board(led_board);  // refresh strip
 }
 
 
-/* Writes the contents of LED_BOARD to the grid of WS2812 LEDs.
+static void start_frame(const uint8_t *led_board);
+static void start_chains();
+
+/* Scales the palette to the current brightness. Only called between
+ * frames, while the transmit interrupt is not reading shade.
+ */
+static void
+update_shade()
+{
+    uint8_t scale = brightness_scale[brightness];
+    unsigned int i;
+    
+    for (i = 0; i < PALETTE_SIZE; i++) {
+        shade[i].green = (palette[i].green * scale) >> 8;
+        shade[i].red = (palette[i].red * scale) >> 8;
+        shade[i].blue = (palette[i].blue * scale) >> 8;
+    }
+    shade_stale = 0;
+}
+
+/* Returns the color of LED led of a chain, either from the generator of a
+ * streamed frame or from the board. Odd LEDs of a board come from the
+ * high nibble of the pair already loaded.
+ */
+static inline uint8_t
+chain_color(struct tx_channel *channel, unsigned int led)
+{
+    if (channel->source) {
+        return channel->source(channel->first + led) & 0x0F;
+    }
+    if (led & 1) {
+        return channel->pair >> 4;
+    }
+    channel->pair = channel->pairs[led >> 1];
+    return channel->pair & 0x0F;
+}
+
+/* Returns the shade sent for LED led of a chain: its color, or the blend
+ * of its fade while a board LED is fading.
+ */
+static inline const LED *
+chain_shade(struct tx_channel *channel, unsigned int led)
+{
+    uint8_t color = chain_color(channel, led);
+    unsigned int index = channel->first + led;
+    const struct fade *fade = fades;
+    
+    if (channel->source || !(fading[index >> 3] & (1 << (index & 7)))) {
+        return &shade[color];
+    }
+    while (fade->led != index) fade++;
+    return &fade->now;
+}
+
+/* Starts writing the contents of LED_BOARD to the grid of WS2812 LEDs.
  *
  * These LEDs transmit and interpret information via an NRZ protocol. This
  * requires transmitting each bit as a long (550 - 850) or short
  * (200 - 500) pulse representing a 1 or a 0 respectively.
  *
  * SPI is used for to send a number of 1's set by the macros HIGH_CODE and
- * LOW_CODE for timing purposes.
+ * LOW_CODE for timing purposes. The colors are looked up in "shade".
  *
- * After writing the entire contents of LED_BOARD, this function delays for
- * 50us to ensure future calls overwrite the current LED board state. (50us
- * delay communicates end of new data).
+ * With SPI_CHANNELS set to 2, the first half of the board is sent on
+ * USCI A0 and the second half on USCI B0 at the same time, each to its
+ * own chain, which halves the frame time.
+ *
+ * Only the LEDs of each chain up to the last one changed by set_color()
+ * or fill_strip() since the previous frame are sent; the LEDs after it
+ * keep their color.
+ * If nothing changed, no frame is sent at all. Passing a different board
+ * than the previous call always sends the whole board. Passing the back
+ * board commits it instead (see commit_board()).
+ *
+ * The frame is sent in the background by the USCI TX interrupt (see
+ * transmit_next_led()), so this function returns as soon as the first
+ * LED is looked up. If the previous frame is still being sent, it first
+ * sleeps until that frame is done. led_board is read while the frame is
+ * on the wire; changes made before refresh_busy() returns 0 may show up
+ * in the current frame.
  */
 void
 refresh_board(uint8_t *led_board)
 {
-    // Disable interrupts to avoid normal SPI driven protocols.
-    __bic_SR_register(GIE);
+    if (led_board == back) {
+        commit_board();
+        return;
+    }
+    
+    if (led_board != tx_board) {
+        mark_all_dirty();
+    }
     
-    // send RGB color for every LED
-    unsigned int i, j;
-    for (i = 0; i < NUM_LEDS; i++) {
-        expand_color(i, led_board);
-        unsigned char *rgb = (unsigned char *)&expanded_color; // get GRB color for this LED
+    if (num_fades) {
+        refresh_wait();
+        advance_fades();
+    }
+    
+    // Skip frames without changes.
+    if (!board_dirty()) return;
+    
+    refresh_wait();
+    start_frame(led_board);
+}
+
+/* Returns the back board, which the next frame is drawn into. */
+uint8_t *
+back_board()
+{
+    return back;
+}
+
+/* Swaps the front and back boards and starts transmitting the new front
+ * board. Returns the new back board, which holds a copy of the committed
+ * frame so drawing can continue incrementally.
+ *
+ * The old front board may still be on the wire, so the swap waits for
+ * that frame to be latched. Frame N+1 can therefore be drawn while frame
+ * N is shifted out. The transmit interrupt only reads the board captured
+ * when a frame starts, so it never sees a half finished swap.
+ */
+uint8_t *
+commit_board()
+{
+    unsigned int changed[SPI_CHANNELS];
+    unsigned int channel;
+    uint8_t *drawn = back;
+    
+    if (num_fades) {
+        refresh_wait();
+        advance_fades();
+    }
+    
+    // Skip frames without changes.
+    if (!board_dirty()) return back;
+    
+    memcpy(changed, dirty_end, sizeof(changed));
+    refresh_wait();
+    back = front;
+    front = drawn;
+    start_frame(front);
+    
+    // The boards only differ in the prefixes changed since the last commit.
+    for (channel = 0; channel < SPI_CHANNELS; channel++) {
+        unsigned int first = channel * (CHANNEL_LEDS / LEDS_PER_BYTE);
+        memcpy(back + first, front + first,
+               (changed[channel] + LEDS_PER_BYTE - 1) / LEDS_PER_BYTE);
+    }
+    return back;
+}
+
+/* Starts sending a frame of leds LEDs generated on the fly by source,
+ * without a board.
+ *
+ * source(led) returns the color of LED led and is called by the USCI TX
+ * interrupt just before that LED is encoded, in order from LED 0. It has
+ * a few microseconds, so it should compute the color from small state
+ * like sprites, a tile map or bitboards, which must not change until
+ * refresh_busy() returns 0. With SPI_CHANNELS set to 2, the first chain
+ * sends (leds + 1) / 2 LEDs and the second the rest, and the two halves
+ * are generated interleaved.
+ *
+ * Frames are not limited to NUM_LEDS, so chains longer than the board
+ * RAM could hold can be driven. The next refresh of a board sends all
+ * of it again.
+ */
+void
+stream_board(pixel_source source, unsigned int leds)
+{
+    unsigned int channel;
+    unsigned int first = 0;
+    
+    refresh_wait();
+    for (channel = 0; channel < SPI_CHANNELS; channel++) {
+        struct tx_channel *chain = &tx_channels[channel];
         
-        // Transmit the colors in GRB order.
-        for (j = 0; j < 3; j++) {
-            
-            // Mask out the MSB of each byte first.
-            unsigned char mask = 0x80;
-            
-            // Send each of the 8 bits as long and short pulses.
-            while (mask != 0) {
-                
-                // Wait on the previous transmission to complete.
-                while (!(IFG2 & UCA0TXIFG))
-                    ;
-                if (rgb[j] & mask) {
-                    UCA0TXBUF = HIGH_CODE;  // Send a long pulse for 1.
-                } else {
-                    UCA0TXBUF = LOW_CODE;   // Send a short pulse for 0.
-                }
-                
-                mask >>= 1;  // Send the next bit.
-            }
-        }
+        // An odd LED goes to the first chain, which paces the interrupt.
+        chain->source = source;
+        chain->first = first;
+        chain->end = (leds + SPI_CHANNELS - 1 - channel) / SPI_CHANNELS;
+        first += chain->end;
+    }
+    tx_board = 0;
+    mark_all_dirty();
+    start_chains();
+}
+
+/* Starts the transmit interrupt on the dirty prefixes of led_board. The
+ * chains shift side by side, so each sends the longest prefix: the LEDs
+ * after its own are unchanged and cost no extra time.
+ */
+static void
+start_frame(const uint8_t *led_board)
+{
+    unsigned int channel;
+    unsigned int end = 0;
+    
+    tx_board = led_board;
+    for (channel = 0; channel < SPI_CHANNELS; channel++) {
+        if (dirty_end[channel] > end) end = dirty_end[channel];
+        dirty_end[channel] = 0;
+    }
+    for (channel = 0; channel < SPI_CHANNELS; channel++) {
+        struct tx_channel *chain = &tx_channels[channel];
+        
+        chain->source = 0;
+        chain->first = channel * CHANNEL_LEDS;
+        chain->pairs = led_board + channel * (CHANNEL_LEDS / LEDS_PER_BYTE);
+        chain->end = end;
     }
+    start_chains();
+}
+
+/* Looks up the first LED of every chain and starts the transmit
+ * interrupt. The first chain is never shorter than the second.
+ */
+static void
+start_chains()
+{
+    unsigned int channel;
+    
+    if (shade_stale) update_shade();
     
-    // Delay for at least 50us to send RES code and signify end of transmission.
-    __delay_cycles(800);
+    tx_led = 0;
+    tx_end = tx_channels[0].end;
+    for (channel = 0; channel < SPI_CHANNELS; channel++) {
+        struct tx_channel *chain = &tx_channels[channel];
+        
+        if (chain->end) chain->shade = chain_shade(chain, 0);
+    }
+    if (!tx_end) return;
+    frame_busy = 1;
+    frame_edges++;
     
-    // Re-enable interrupts
+    // TXIFG is set while the USCI is idle, so the first LED is sent right
+    // away. The first chain paces the interrupt and the second follows.
+    IE2 |= UCA0TXIE;
+}
+
+/* Returns 1 while a frame is being transmitted or latched. */
+unsigned int
+refresh_busy()
+{
+    return frame_busy;
+}
+
+/* Returns the frames started plus the frames latched, odd while one is
+ * busy.
+ */
+unsigned int
+refresh_count()
+{
+    return frame_edges;
+}
+
+/* Sleeps in LPM0 until the frame being transmitted has been latched. */
+void
+refresh_wait()
+{
+    // Check and sleep with interrupts disabled so the end of the frame
+    // can't slip in between.
+    __bic_SR_register(GIE);
+    while (frame_busy) {
+        refresh_waiting = 1;
+        __bis_SR_register(LPM0_bits | GIE);
+        __bic_SR_register(GIE);
+    }
+    refresh_waiting = 0;
     __bis_SR_register(GIE);
 }
+
+/* Sends the codes of color byte "value" on USCI A0, MSB first, each as
+ * soon as the TX buffer is free.
+ */
+static inline void
+send_byte(uint8_t value)
+{
+    uint8_t mask;
+    
+    for (mask = 0x80; mask; mask >>= 1) {
+        while (!(IFG2 & UCA0TXIFG));
+        UCA0TXBUF = (value & mask) ? HIGH_CODE : LOW_CODE;
+    }
+}
+
+#if SPI_CHANNELS == 2
+/* Sends color byte "a" on USCI A0 and "b" on USCI B0 side by side. B0 is
+ * always written first, so its buffer is free whenever A0's is.
+ */
+static inline void
+send_byte_pair(uint8_t a, uint8_t b)
+{
+    uint8_t mask;
+    
+    for (mask = 0x80; mask; mask >>= 1) {
+        while (!(IFG2 & UCA0TXIFG));
+        UCB0TXBUF = (b & mask) ? HIGH_CODE : LOW_CODE;
+        UCA0TXBUF = (a & mask) ? HIGH_CODE : LOW_CODE;
+    }
+}
+#endif
+
+/* Sends the next LED of the frame on every chain. Called by the USCI
+ * A0/B0 TX interrupt whenever the TX buffer of the first chain is empty.
+ *
+ * A code shifts out in 24 SMCLK cycles, less than an interrupt per code
+ * takes to enter, run and return, so the 24 codes of the LED are written
+ * in a loop as soon as the buffer is free: about 20 cycles a code on one
+ * chain, and about 30 on two, where every low is stretched by 0.4us. The
+ * next LED is looked up before returning, so the low between two LEDs
+ * also spans the lookup, the return and the next entry: 3.9us on the host
+ * build with HOST_ISR_CYCLES 60, and up to 11.5us in its game runs, where
+ * the sensing and timer interrupts are taken in between. A low that long
+ * may latch a 50us reset part early. A full frame takes about 5.0ms
+ * instead of the 4.6ms on the wire. After the last LED, the TX interrupt
+ * is disabled and TA1 CCR2 is armed to end the frame once the 50us reset
+ * time has passed.
+ */
+void
+transmit_next_led()
+{
+    const LED *a = tx_channels[0].shade;
+    struct tx_channel *chain;
+    
+#if SPI_CHANNELS == 2
+    if (tx_led < tx_channels[1].end) {
+        const LED *b = tx_channels[1].shade;
+        
+        send_byte_pair(a->green, b->green);
+        send_byte_pair(a->red, b->red);
+        send_byte_pair(a->blue, b->blue);
+    } else
+#endif
+    {
+        send_byte(a->green);
+        send_byte(a->red);
+        send_byte(a->blue);
+    }
+    
+    if (++tx_led == tx_end) {
+        IE2 &= ~UCA0TXIE;
+        
+        // Latch after the last codes are shifted out and the reset time passed.
+        TA1CCR2 = TA1R + LATCH_TIME;
+        TA1CCTL2 = CCIE;
+        return;
+    }
+    for (chain = tx_channels; chain < tx_channels + SPI_CHANNELS; chain++) {
+        if (tx_led < chain->end) chain->shade = chain_shade(chain, tx_led);
+    }
+}
+
+/* Marks the frame as latched. Called by the TA1 CCR2 interrupt.
+ *
+ * Returns 1 if refresh_wait() is sleeping and the CPU should be woken.
+ */
+unsigned int
+end_frame()
+{
+    TA1CCTL2 &= ~CCIE;
+    frame_busy = 0;
+    frame_edges++;
+    return refresh_waiting;
+}
@@ -4,30 +4,151 @@
  * void clear_strip(uint8_t *led_board);
  *      Turns off all the LEDs on the board
  * 
- * void expand_color(unsigned int led);
- *      Expands the internal representation of colors to 3 byte GRB form.
- * 
- * void expand_color(unsigned int led);
- *      Expands the internal representation of colors to 3 byte GRB form.
- * 
  * void fill_strip(uint8_t color, uint8_t *led_board);
  *      Sets all LEDs on the board to color.
  * 
  * void refresh_board(uint8_t *led_board);
- *      Updates the LED grip to the colors in internal representation
- *      "led_board".
+ *      Starts updating the LED grid to the colors in internal
+ *      representation "led_board". Returns while the frame is sent in the
+ *      background. Only LEDs up to the last changed one are sent, and
+ *      unchanged boards are not sent at all.
+ *
+ * void stream_board(pixel_source source, unsigned int leds);
+ *      Starts sending a frame of leds LEDs whose colors are generated by
+ *      source(led) just before each LED is encoded, without a board.
+ *
+ * uint8_t *back_board();
+ *      Returns the back board of the double buffer. The game draws the
+ *      next frame into it while the front board is transmitted.
+ *
+ * uint8_t *commit_board();
+ *      Swaps the back and front boards and starts transmitting the new
+ *      front board. Returns the new back board, a copy of the committed
+ *      frame. refresh_board() on the back board does the same.
+ *
+ * unsigned int refresh_busy();
+ *      Returns 1 while a frame is being transmitted.
+ *
+ * void refresh_wait();
+ *      Sleeps until the frame being transmitted has been latched.
+ *
+ * unsigned int refresh_count();
+ *      Returns a count that steps when a frame starts and when it has
+ *      been latched, so it is odd while a frame is busy. A measurement
+ *      timed by an interrupt is only exact if the count was even and
+ *      unchanged over it, as the transmit interrupt holds the others off.
+ *
+ * void transmit_next_led();
+ *      Called by the USCI A0/B0 TX interrupt to send the next LED.
+ *
+ * unsigned int end_frame();
+ *      Called by the TA1 CCR2 interrupt once the frame has been latched.
+ *      Returns 1 if the CPU should leave LPM0.
  *      
  * void set_color(unsigned int led, uint8_t color, uint8_t *led_board);
  *      Sets the color in "led_board" to color.
+ *
+ * uint8_t get_color(unsigned int led, const uint8_t *led_board);
+ *      Returns the color of the LED at index led in "led_board".
+ *
+ * unsigned int fade_color(unsigned int led, uint8_t from, uint8_t to,
+ *                         unsigned int frames, uint8_t *led_board);
+ *      Sets the color in "led_board" to "to" and shows the LED fading
+ *      there from "from" over the next frames frames. Fades move on once
+ *      per refresh_board() or commit_board(), not with time, so they are
+ *      shown by ANIM_FADES, which refreshes at a fixed rate. Returns 0 if
+ *      too many fades are running to start it.
+ *
+ * unsigned int fades_active();
+ *      Returns the number of fades still running.
+ *
+ * void load_palette(const LED *colors);
+ *      Replaces the GRB values of the PALETTE_SIZE colors. 0 restores the
+ *      default palette.
+ *
+ * void set_brightness(uint8_t level);
+ * uint8_t get_brightness();
+ *      Sets and returns the gamma corrected brightness level applied to
+ *      the palette, 0 to MAX_BRIGHTNESS.
+ *
+ * "led_board" packs the 4 bit colors of two LEDs into each byte, so a
+ * board of NUM_LEDS LEDs takes NUM_LEDS / LEDS_PER_BYTE bytes.
  ************************************************************************/
 
 #ifndef led_control_h
 #define led_control_h
 
 #include <stdio.h>
+
+/* WS2812 bit encoding: every LED bit is sent as one SPI byte, 0xF0 or
+ * 0xC0 at 187.5ns per SPI bit, i.e. a code every 24 SMCLK cycles. Every
+ * code ends low, so a code written late only stretches a low time. The
+ * 50us reset is the low after which the LEDs are sure to latch, not a safe
+ * stretch: WS2812B parts with that reset may latch on lows from about 6us
+ * and show the rest of the frame from the first LED on. Parts with a 280us
+ * reset tolerate far longer lows. Lows inside a frame are kept to about
+ * 4us, but interrupts taken between two LEDs stretch one by their own
+ * length, up to about 11.5us (see transmit_next_led()).
+ */
+
+/* SPI channels the board is split across, each driving its own chain:
+ *  1 - all LEDs chained on USCI A0 (P1.2 MOSI, P1.4 CLK).
+ *  2 - the first 8x8 panel on USCI A0 and the second on USCI B0 (P1.7
+ *      SIMO, P1.5 CLK). Both chains shift out at once, halving the
+ *      frame time.
+ */
+#ifndef SPI_CHANNELS
+#define SPI_CHANNELS 1
+#endif
+
+// LEDs packed into each byte of led_board.
+#define LEDS_PER_BYTE 2
+
+// LED colors, indices into the palette.
+#define OFF           0
+#define RED           1
+#define GREEN         2
+#define BLUE          3
+#define YELLOW        4
+#define PURPLE        5
+
+// Entries in a palette, one for every 4 bit color.
+#define PALETTE_SIZE  16
+
+// Brightness levels
+#define MAX_BRIGHTNESS      15
+#define DEFAULT_BRIGHTNESS  5
+
+// WS2812 LEDs require GRB format
+typedef struct {
+    unsigned char green;
+    unsigned char red;
+    unsigned char blue;
+} LED;
+
+// Generator of a streamed frame: returns the color of LED led.
+typedef uint8_t (*pixel_source)(unsigned int led);
+
+// UCA0BR0 that gives the SPI bit time of the encoding from 16 MHz SMCLK.
+#define SPI_DIVIDER 3
+
 void clear_strip(uint8_t *led_board);
-void expand_color(unsigned int led, uint8_t *led_board);
 void fill_strip(uint8_t color, uint8_t *led_board);
 void refresh_board(uint8_t *led_board);
+void stream_board(pixel_source source, unsigned int leds);
+uint8_t *back_board();
+uint8_t *commit_board();
+unsigned int refresh_busy();
+void refresh_wait();
+unsigned int refresh_count();
+void transmit_next_led();
+unsigned int end_frame();
 void set_color(unsigned int led, uint8_t color, uint8_t *led_board);
+uint8_t get_color(unsigned int led, const uint8_t *led_board);
+unsigned int fade_color(unsigned int led, uint8_t from, uint8_t to,
+                        unsigned int frames, uint8_t *led_board);
+unsigned int fades_active();
+void load_palette(const LED *colors);
+void set_brightness(uint8_t level);
+uint8_t get_brightness();
 #endif /* led_control_h */
@@ -0,0 +1,11 @@
+#!/bin/sh
+# Builds and runs the host tests once per CAP_SENSE_FILTER setting
+# (0 - none, 1 - median, 2 - IIR). Run from the repository root.
+set -e
+out=${TMPDIR:-/tmp}/test_cap_filter
+for filter in 0 1 2; do
+    gcc -DHOST_BUILD -DCAP_SENSE_MODE=1 -DCAP_SENSE_FILTER=$filter -I. \
+        -Wall -O2 -o "$out" tests/test_cap_filter.c hal_host.c \
+        gesture.c timing_funcs.c
+    "$out"
+done
@@ -0,0 +1,310 @@
+/*************************************************************************
+ * Host test of the pad filter and debounce path (-DHOST_BUILD).
+ *
+ * Replays raw traces of a pad through update_pads(), i.e. the
+ * CAP_SENSE_FILTER stage, the boot calibration, the thresholds with their
+ * hysteresis and the CAP_SENSE_DEBOUNCE persistence, and checks the exact
+ * scans at which press and release events are queued. The other pads
+ * read untouched. The traces are in the SMCLK cycles of CAP_SENSE_CAPTURE,
+ * so the press threshold is PRESS_CYCLES and the release threshold half
+ * of it. The first ones are noise-free, on the Up pad:
+ *
+ *  spike  A single scan at a touched level.
+ *  burst  Two scans in a row at a touched level.
+ *  drift  A slow rise of the untouched level that the baseline follows
+ *         within twice its steady lag.
+ *  ramp   A touch ramping in and out over many scans, as seen through a
+ *         slow filter, held long enough to press.
+ *
+ * The others are on the Left pad, with seeded pseudo-random jitter on
+ * every pad and scan, IDLE_JITTER away from a touch and BAND_JITTER in
+ * the hysteresis band, which reaches within 1000 cycles of both
+ * thresholds:
+ *
+ *  hover  A light touch held in the band, which must not press.
+ *  hold   A touch pressed, then held in the band, which must not
+ *         release, then released.
+ *
+ * Every scan also checks that the baseline of each pad is frozen while
+ * its delta is above the release threshold, and that no event presses a
+ * pad whose delta is not above the press threshold or releases one whose
+ * delta is above the release threshold. Build and run from the repository root
+ * once per CAP_SENSE_FILTER setting (tests/run_host_tests.sh does so):
+ *
+ *  gcc -DHOST_BUILD -DCAP_SENSE_MODE=1 -DCAP_SENSE_FILTER=2 -I. \
+ *      -o test_cap_filter tests/test_cap_filter.c hal_host.c \
+ *      gesture.c timing_funcs.c
+ *  ./test_cap_filter
+ *
+ * Exits with 1 if any scenario fails.
+ *
+ *************************************************************************/
+#include <stdio.h>
+#include <string.h>
+
+#include "cap_sense.c"              // The filter stage is static.
+
+#if CAP_SENSE_MODE != CAP_SENSE_CAPTURE
+#error The traces are in CAP_SENSE_CAPTURE cycles!
+#endif
+#if CAP_SENSE_DEBOUNCE != 2
+#error The expected events assume CAP_SENSE_DEBOUNCE 2!
+#endif
+
+#define IDLE_RAW           2000          // Untouched pad delay in cycles.
+#define TOUCH_RAW          40000         // Touched pad delay in cycles.
+#define IDLE_JITTER        1000          // Most jitter of a scan, +- cycles.
+#define LEFT_PAD           3
+
+/* Middle of the hysteresis band above IDLE_RAW, and the jitter that
+ * reaches within 1000 cycles of either threshold.
+ */
+#define BAND_RAW           (IDLE_RAW + 3 * PRESS_CYCLES / 4)
+#define BAND_JITTER        (PRESS_CYCLES / 4 - 1000)
+#define CAL_SCANS          ((1 << CAL_SHIFT) + 1)
+#define MAX_EVENTS         8
+
+typedef struct {
+    unsigned int scan;          // Scan after the calibration, from 0.
+    uint8_t state;              // Pressed pads after the event.
+} SCAN_EVENT;
+
+static SCAN_EVENT events[MAX_EVENTS];
+static unsigned int num_events;
+static unsigned int scans;
+static unsigned int failures;
+static uint8_t test_state;
+static uint32_t jitter_seed;
+
+/* No LED frame is ever sent, so no scan is dropped. */
+unsigned int
+refresh_count()
+{
+    return 0;
+}
+
+/* Restarts the sensing state as after reset. */
+static void
+reset_pads()
+{
+    memset(pads, 0, sizeof(pads));
+    memset(pad_base, 0, sizeof(pad_base));
+    memset(pad_noise, 0, sizeof(pad_noise));
+    memset(debounce_scans, 0, sizeof(debounce_scans));
+#if CAP_SENSE_FILTER == CAP_FILTER_MEDIAN
+    memset(filter_history, 0, sizeof(filter_history));
+#elif CAP_SENSE_FILTER == CAP_FILTER_IIR
+    memset(filter_average, 0, sizeof(filter_average));
+#endif
+    cal_scans = 0;
+    pads_pressed = 0x00;
+    touch_flush();
+    gesture_flush();
+    num_events = 0;
+    scans = 0;
+}
+
+/* Returns a pseudo-random offset of up to +-"amplitude" cycles. The LCG
+ * is seeded by calibrate(), so every run replays the same jitter.
+ */
+static int
+jitter(int amplitude)
+{
+    jitter_seed = jitter_seed * 1103515245UL + 12345;
+    return (int)((jitter_seed >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+/* Checks that an event only presses pads above the press threshold and
+ * releases pads at or below the release threshold.
+ */
+static void
+check_hysteresis(const TOUCH_EVENT *event)
+{
+    int pad;
+    
+    for (pad = 0; pad < 5; pad++) {
+        const PAD *p = &pads[pad];
+        uint8_t bit = 1 << pad;
+        
+        if (!(event->changed & bit)) continue;
+        if ((event->state & bit) ? p->delta <= p->press_threshold
+                                 : p->delta > p->release_threshold) {
+            printf("  scan %u: pad %d %s at delta %u, thresholds %u/%u\n",
+                   scans, pad, (event->state & bit) ? "pressed" : "released",
+                   p->delta, p->press_threshold, p->release_threshold);
+            failures++;
+        }
+    }
+}
+
+/* Feeds one scan with "raw" on pad "touched" and IDLE_RAW on the others
+ * through update_pads() and records the events it queued. The touched pad
+ * is off by up to +-"noise" cycles, the others by up to IDLE_JITTER of it.
+ */
+static void
+scan_pad(int touched, uint16_t raw, int noise)
+{
+    int idle_noise = noise < IDLE_JITTER ? noise : IDLE_JITTER;
+    uint16_t base[5];
+    TOUCH_EVENT event;
+    int pad;
+    
+    for (pad = 0; pad < 5; pad++) {
+        base[pad] = pads[pad].baseline;
+        if (pad == touched) {
+            pads[pad].raw = raw + (noise ? jitter(noise) : 0);
+        } else {
+            pads[pad].raw = IDLE_RAW + (idle_noise ? jitter(idle_noise) : 0);
+        }
+    }
+    update_pads(&test_state);
+    while (touch_event(&event)) {
+        check_hysteresis(&event);
+        if (num_events < MAX_EVENTS) {
+            events[num_events].scan = scans;
+            events[num_events].state = event.state;
+        }
+        num_events++;
+    }
+    for (pad = 0; pad < 5; pad++) {
+        if (cal_scans > 1 << CAL_SHIFT
+                && pads[pad].delta > pads[pad].release_threshold
+                && pads[pad].baseline != base[pad]) {
+            printf("  scan %u: pad %d baseline moved %u -> %u at delta %u\n",
+                   scans, pad, base[pad], pads[pad].baseline, pads[pad].delta);
+            failures++;
+        }
+    }
+    scans++;
+}
+
+/* Feeds one noise-free scan with "raw" on the Up pad. */
+static void
+scan(uint16_t raw)
+{
+    scan_pad(0, raw, 0);
+}
+
+/* Calibrates all pads on IDLE_RAW off by up to +-"noise" cycles, so the
+ * next scan is scan 0.
+ */
+static void
+calibrate(int noise)
+{
+    int i;
+    
+    reset_pads();
+    jitter_seed = 1;
+    for (i = 0; i < CAL_SCANS; i++) {
+        scan_pad(0, IDLE_RAW, noise);
+    }
+    scans = 0;
+}
+
+/* Compares the recorded events with the "count" ones in "expected". */
+static void
+check_events(const char *name, const SCAN_EVENT *expected, unsigned int count)
+{
+    unsigned int i;
+    unsigned int ok = num_events == count;
+    
+    for (i = 0; ok && i < count; i++) {
+        ok = events[i].scan == expected[i].scan
+                && events[i].state == expected[i].state;
+    }
+    printf("%s %s:", ok ? "ok  " : "FAIL", name);
+    for (i = 0; i < num_events && i < MAX_EVENTS; i++) {
+        printf(" %u:%02x", events[i].scan, events[i].state);
+    }
+    printf(", expected");
+    for (i = 0; i < count; i++) {
+        printf(" %u:%02x", expected[i].scan, expected[i].state);
+    }
+    printf("\n");
+    if (!ok) failures++;
+}
+
+/* Expected events per CAP_SENSE_FILTER, with CAP_SENSE_DEBOUNCE 2. */
+#if CAP_SENSE_FILTER == CAP_FILTER_MEDIAN
+// A single scan never passes the median, two pass one scan late.
+static const SCAN_EVENT burst_events[] = {{7, 0x01}, {9, 0x00}};
+#define BURST_EVENTS 2
+static const SCAN_EVENT ramp_events[] = {{24, 0x01}, {48, 0x00}};
+static const SCAN_EVENT hold_events[] = {{7, 0x08}, {217, 0x00}};
+#elif CAP_SENSE_FILTER == CAP_FILTER_IIR
+// Two scans only take the average 7/16 of the way to a touch.
+static const SCAN_EVENT burst_events[] = {{0, 0x00}};
+#define BURST_EVENTS 0
+static const SCAN_EVENT ramp_events[] = {{26, 0x01}, {49, 0x00}};
+static const SCAN_EVENT hold_events[] = {{12, 0x08}, {217, 0x00}};
+#else
+// The debounce alone rejects a single scan but not two.
+static const SCAN_EVENT burst_events[] = {{6, 0x01}, {8, 0x00}};
+#define BURST_EVENTS 2
+static const SCAN_EVENT ramp_events[] = {{23, 0x01}, {47, 0x00}};
+static const SCAN_EVENT hold_events[] = {{6, 0x08}, {216, 0x00}};
+#endif
+
+#define RAMP_SCANS         20            // Scans to ramp in and out.
+#define BAND_SCANS         200           // Scans held in the hysteresis band.
+#define RAMP_HOLD          10            // Scans held at TOUCH_RAW.
+#define DRIFT_STEP         16            // Drift per scan in cycles.
+#define DRIFT_SCANS        1000
+#define DRIFT_END          (IDLE_RAW + DRIFT_SCANS * DRIFT_STEP)
+
+int
+main()
+{
+    int i;
+    
+    printf("CAP_SENSE_FILTER %d, CAP_SENSE_DEBOUNCE %d\n",
+           CAP_SENSE_FILTER, CAP_SENSE_DEBOUNCE);
+    
+    calibrate(0);
+    for (i = 0; i < 5; i++) scan(IDLE_RAW);
+    scan(TOUCH_RAW);
+    for (i = 0; i < 20; i++) scan(IDLE_RAW);
+    check_events("spike", 0, 0);
+    
+    calibrate(0);
+    for (i = 0; i < 5; i++) scan(IDLE_RAW);
+    scan(TOUCH_RAW);
+    scan(TOUCH_RAW);
+    for (i = 0; i < 20; i++) scan(IDLE_RAW);
+    check_events("burst", burst_events, BURST_EVENTS);
+    
+    calibrate(0);
+    for (i = 1; i <= DRIFT_SCANS; i++) scan(IDLE_RAW + i * DRIFT_STEP);
+    check_events("drift", 0, 0);
+    if (pads[0].baseline < DRIFT_END - (2 * DRIFT_STEP << DRIFT_SHIFT)) {
+        printf("FAIL drift: baseline %u of %u\n", pads[0].baseline, DRIFT_END);
+        failures++;
+    }
+    
+    calibrate(0);
+    for (i = 0; i < 5; i++) scan(IDLE_RAW);
+    for (i = 1; i <= RAMP_SCANS; i++) {
+        scan(IDLE_RAW + (long)(TOUCH_RAW - IDLE_RAW) * i / RAMP_SCANS);
+    }
+    for (i = 0; i < RAMP_HOLD; i++) scan(TOUCH_RAW);
+    for (i = RAMP_SCANS - 1; i >= 0; i--) {
+        scan(IDLE_RAW + (long)(TOUCH_RAW - IDLE_RAW) * i / RAMP_SCANS);
+    }
+    for (i = 0; i < 20; i++) scan(IDLE_RAW);
+    check_events("ramp", ramp_events, 2);
+    
+    calibrate(IDLE_JITTER);
+    for (i = 0; i < 5; i++) scan_pad(LEFT_PAD, IDLE_RAW, IDLE_JITTER);
+    for (i = 0; i < BAND_SCANS; i++) scan_pad(LEFT_PAD, BAND_RAW, BAND_JITTER);
+    for (i = 0; i < 20; i++) scan_pad(LEFT_PAD, IDLE_RAW, IDLE_JITTER);
+    check_events("hover", 0, 0);
+    
+    calibrate(IDLE_JITTER);
+    for (i = 0; i < 5; i++) scan_pad(LEFT_PAD, IDLE_RAW, IDLE_JITTER);
+    for (i = 0; i < 10; i++) scan_pad(LEFT_PAD, TOUCH_RAW, IDLE_JITTER);
+    for (i = 0; i < BAND_SCANS; i++) scan_pad(LEFT_PAD, BAND_RAW, BAND_JITTER);
+    for (i = 0; i < 20; i++) scan_pad(LEFT_PAD, IDLE_RAW, IDLE_JITTER);
+    check_events("hold", hold_events, 2);
+    
+    return failures ? 1 : 0;
+}
@@ -1,10 +1,117 @@
-#include <msp430.h>
+#include "hal.h"
 #include <stdint.h>
 
 #include "timing_funcs.h"
 
+#define MIN_SLEEP 64                // Cycles not worth sleeping for.
+#define MAX_SLEEP 0x40000000UL      // Longest sleep of run_tasks(), in cycles.
+
+static volatile uint16_t overflows = 0;    // TA1R overflows.
+static volatile uint32_t deadline;         // Time wait() sleeps until.
+static volatile uint8_t deadline_set = 0;  // A sleep waits for the deadline.
+
+/* Run-to-completion tasks of run_tasks(). A task runs every "period"
+ * cycles and, if "on_input" is set, as soon as the pressed buttons
+ * change, which restarts its period.
+ */
+struct task {
+    void (*run)(void);
+    uint32_t period;
+    uint32_t next;                  // timer_now() of the next run.
+    uint8_t on_input;
+};
+
+static struct task tasks[MAX_TASKS];
+static uint8_t num_tasks = 0;
+static uint8_t tasks_end = 0;       // Tasks of the running run_tasks() calls.
+static uint8_t tasks_running = 0;
+
+/*
+ * Returns the cycles since setup: TA1R, which runs continuously on SMCLK,
+ * extended by its overflows. Wraps after about 268s, so only differences
+ * of times are meaningful. Also called from interrupts, where an overflow
+ * may be pending.
+ */
+uint32_t
+timer_now()
+{
+    uint16_t high;
+    uint16_t low;
+    
+    do {
+        high = overflows;
+        low = TA1R;
+    } while (high != overflows);
+    
+    // Overflowed, but the interrupt hasn't counted it yet.
+    if ((TA1CTL & TAIFG) && low < 0x8000) high++;
+    return ((uint32_t)high << 16) | low;
+}
+
+/*
+ * Triggered by the TA1 CCR0 interrupt, which is only armed in the TA1R
+ * period holding the deadline. Returns 1 and disables the interrupt once
+ * the deadline has been reached, so wait() wakes up only then.
+ */
+unsigned int
+timer_deadline()
+{
+    if ((int32_t)(deadline - timer_now()) > 0) return 0;
+    TA1CCTL0 &= ~CCIE;
+    deadline_set = 0;
+    return 1;
+}
+
+/*
+ * Counts an overflow of TA1R. Triggered by the TA1 overflow interrupt.
+ * Arms CCR0 with the low 16 bits of a deadline once its period starts, so
+ * a sleep of any length takes a single CCR0 interrupt. Returns 1 if the
+ * deadline already passed and the CPU should leave LPM0.
+ */
+unsigned int
+timer_overflow()
+{
+    overflows++;
+    if (!deadline_set || (uint16_t)(deadline >> 16) != overflows) return 0;
+    
+    TA1CCR0 = (uint16_t)deadline;
+    TA1CCTL0 = CCIE;
+    
+    // TA1R may have passed a deadline early in the period already.
+    return timer_deadline();
+}
+
+/*
+ * Sleeps in LPM0 once, until "end" or an earlier interrupt that wakes the
+ * CPU. Must be called with interrupts disabled, which it leaves disabled,
+ * so the deadline can't slip in between the caller's check and the sleep.
+ */
+static void
+sleep_until(uint32_t end)
+{
+    if ((int32_t)(end - timer_now()) <= MIN_SLEEP) return;
+    deadline = end;
+    deadline_set = 1;
+    
+    // Later periods are armed by timer_overflow().
+    if ((uint16_t)(end >> 16) == (uint16_t)(timer_now() >> 16)) {
+        TA1CCR0 = (uint16_t)end;
+        TA1CCTL0 = CCIE;
+    }
+    
+    // Arming CCR0 clears CCIFG, so a compare TA1R passed while it was
+    // armed would never wake the CPU. Don't sleep past the deadline then.
+    if ((int32_t)(end - timer_now()) > 0) {
+        __bis_SR_register(LPM0_bits | GIE);
+        __bic_SR_register(GIE);
+    }
+    TA1CCTL0 &= ~CCIE;
+    deadline_set = 0;
+}
+
 /*
- * Uses the timerA0 interrupt to wait for the input number of milliseconds. 
+ * Sleeps in LPM0 until "milliseconds" after now with one TA1 CCR0 compare
+ * instead of a wakeup per ms. Other interrupts may wake the CPU earlier.
  * 
  * When allow_interupt is > 0, the wait can be interrupted when 
  * a button is pressed (i.e. button_state) > 0.
@@ -12,29 +119,145 @@
  * Returns 1 if interrupted.
  */
 unsigned int
-wait(int milliseconds, uint8_t *button_state, int allow_interrupt)
+wait(int milliseconds, volatile uint8_t *button_state, int allow_interrupt)
 {
-    // timerA1 interrupts every 1ms.
-    int dur_count;
-    for (dur_count = 0; dur_count < milliseconds; dur_count++) {
+    uint32_t end = timer_now() + milliseconds * MS_CYCLES;
+    
+    // Check and sleep with interrupts disabled so the deadline can't
+    // slip in between.
+    __bic_SR_register(GIE);
+    while ((int32_t)(end - timer_now()) > MIN_SLEEP) {
         if (*button_state && allow_interrupt) {
+            __bis_SR_register(GIE);
             return 1;
         }
-          __bis_SR_register(LPM0_bits); //Enters low power mode for 1ms
+        sleep_until(end);
     }
+    __bis_SR_register(GIE);
     return 0;
 }
 
 /*
  * Cannot be interrupted by button presses.
- * Uses the timerA0 interrupt to wait for the input number
- * of milliseconds.
+ * Sleeps until the input number of milliseconds passed.
  */
 void
 blocking_wait(int milliseconds)
 {
-    int dur_count;
-    for (dur_count = 0; dur_count < milliseconds; dur_count++) {
-          __bis_SR_register(LPM0_bits); //Enters low power mode for .1ms
+    uint8_t no_press = 0;
+    
+    wait(milliseconds, &no_press, 0);
+}
+
+/*
+ * Adds a task for the next run_tasks(): "run" is called every
+ * "period_ms" ms, and with "on_input" > 0 also as soon as the pressed
+ * buttons change. The first run is one period from now.
+ *
+ * Returns 0 without adding the task if MAX_TASKS tasks are added already.
+ */
+unsigned int
+task_add(void (*run)(void), int period_ms, int on_input)
+{
+    struct task *task;
+    
+    if (num_tasks == MAX_TASKS) return 0;
+    task = &tasks[num_tasks++];
+    
+    task->run = run;
+    task->period = period_ms * MS_CYCLES;
+    task->next = timer_now() + task->period;
+    task->on_input = on_input;
+    return 1;
+}
+
+/*
+ * Ends the innermost run_tasks() once the running task returns.
+ */
+void
+stop_tasks()
+{
+    tasks_running = 0;
+}
+
+/*
+ * Runs the added tasks until one calls stop_tasks(), then removes them.
+ * Returns at once if none were added.
+ * Tasks run to completion in the order they were added; in between, the
+ * CPU sleeps in LPM0 until the next task is due or the value pointed to
+ * by "button_state" changes. The TA1 CCR1 interrupt that publishes a new
+ * button state wakes the CPU, so an input task reacts as soon as the scan
+ * ends, after at most the longest run of the tasks before it. Tasks that
+ * refresh_board() first wait for the frame on its way, so the bound from
+ * a published press to its frame latched on the grid is two frame times.
+ * The dodge game streams all 128 LEDs. The host build prints the press to
+ * frame latency at the end of a run; selecting the dodge game and making
+ * four moves with
+ *
+ *   HOST_SIM_MS=8000 HOST_PRESS="3000:1,3600:0,4500:8,4800:0,5500:2,
+ *   5800:0,6500:4,6800:0,7500:1,7800:0" ./cap_game
+ *
+ * measures 5.03 to 5.06ms for every move in all sensing modes (2.55ms
+ * with SPI_CHANNELS 2), which bounds it to about 10.1ms, against up to
+ * 108ms with the old 100ms wait() loop. These are simulator figures: the
+ * host charges every interrupt its default HOST_ISR_CYCLES, but counts the
+ * C code of the tasks as free, so on the target their run time adds on.
+ *
+ * Tasks that change the board refresh it themselves rather than leave it
+ * to an LED task: the frame is sent by the TX interrupt in the background
+ * anyway, and a separate task would add up to its period of latency.
+ *
+ * A task may add tasks and run them with a nested run_tasks(), e.g. to
+ * play an animation. The nested call only runs the tasks added after the
+ * enclosing call started, and the enclosing tasks resume once they stop.
+ */
+void
+run_tasks(volatile uint8_t *button_state)
+{
+    uint8_t last_state = *button_state;
+    uint8_t input;
+    uint32_t now;
+    uint32_t next;
+    int t;
+    uint8_t first = tasks_end;
+    uint8_t outer_running = tasks_running;
+    
+    // Nothing to run, e.g. task_add() found the table full, would sleep
+    // for good.
+    if (first == num_tasks) return;
+    tasks_end = num_tasks;
+    tasks_running = 1;
+    while (tasks_running) {
+        input = *button_state != last_state;
+        last_state = *button_state;
+        
+        now = timer_now();
+        next = now + MAX_SLEEP;
+        for (t = first; t < num_tasks && tasks_running; t++) {
+            struct task *task = &tasks[t];
+            
+            uint8_t woken = input && task->on_input;
+            
+            if (woken || (int32_t)(now - task->next) >= 0) {
+                // Keep the period unless it fell behind or input restarts it.
+                task->next += task->period;
+                if (woken || (int32_t)(now - task->next) >= 0) {
+                    task->next = now + task->period;
+                }
+                task->run();
+                now = timer_now();
+            }
+            if ((int32_t)(task->next - next) < 0) next = task->next;
+        }
+        
+        // Sleep until the next task unless the buttons changed meanwhile.
+        __bic_SR_register(GIE);
+        if (tasks_running && *button_state == last_state) sleep_until(next);
+        __bis_SR_register(GIE);
     }
+    
+    // Back to the enclosing tasks, if any.
+    num_tasks = first;
+    tasks_end = first;
+    tasks_running = outer_running;
 }
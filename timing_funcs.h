@@ -1,8 +1,23 @@
 #ifndef _TIMING_FUNCS_H_
 #define _TIMING_FUNCS_H_
  
+// SMCLK cycles per ms, the unit of timer_now().
+#define MS_CYCLES 16000UL
+
+// Time base: TA1R extended to 32 bits by its overflows.
+uint32_t timer_now();
+unsigned int timer_overflow();
+unsigned int timer_deadline();
+
 // Timing
 void blocking_wait(int milliseconds);
-unsigned int wait(int milliseconds, uint8_t *debounced_state, int allow_interrupt);
+unsigned int wait(int milliseconds, volatile uint8_t *debounced_state, int allow_interrupt);
+
+// Cooperative scheduler
+#define MAX_TASKS 4
+
+unsigned int task_add(void (*run)(void), int period_ms, int on_input);
+void run_tasks(volatile uint8_t *button_state);
+void stop_tasks();
 
 #endif